@@ -0,0 +1,410 @@
+#pragma once
+
+#include "sw_fwd.h"  // Forward declaration
+#include "intrusive.h"
+#include "shared.h"
+
+#include <cassert>
+#include <cstddef>  // std::nullptr_t
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <sys/mman.h>
+
+// Compressed pointers for large object graphs that live in one arena. An `Arena<Tag>` is a single
+// reserved address range, and pointers into it are stored as 32-bit offsets counted in 8-byte
+// granules, which covers 32 GiB. `OffsetIntrusivePtr` is then half the size of `IntrusivePtr`,
+// and `OffsetSharedPtr` (object and control block offsets) half the size of `SharedPtr`.
+//
+// The tag type selects the arena, so decoding an offset is one add to a static base address.
+// Objects are placed by `MakeOffsetIntrusive` / `MakeOffsetShared` and recycled through per-size
+// free lists. Like `ObjectPool`, an arena is not synchronized: use it from one thread.
+
+struct DefaultArena {};
+
+template <typename Tag = DefaultArena>
+class Arena {
+public:
+    static constexpr size_t kGranule = 8;
+    static constexpr size_t kMaxCapacity = (size_t{1} << 32) * kGranule;
+
+    // Reserves address space for the arena; memory is committed by the OS as it gets touched.
+    // Called with `kMaxCapacity` on first use unless called before.
+    static void Reserve(size_t capacity) {
+        assert(base_ == nullptr && "Arena is already reserved");
+        assert(capacity <= kMaxCapacity && "Offsets cover at most 32 GiB");
+        void* base = mmap(nullptr, capacity, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (base == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        base_ = static_cast<char*>(base);
+        capacity_ = capacity;
+    }
+
+    static void* Allocate(size_t size) {
+        size_t granules = Granules(size);
+        if (granules < free_.size() && free_[granules] != 0) {
+            uint32_t offset = free_[granules];
+            free_[granules] = *static_cast<uint32_t*>(Address(offset));
+            return Address(offset);
+        }
+        if (base_ == nullptr) {
+            Reserve(kMaxCapacity);
+        }
+        if (used_ + granules * kGranule > capacity_) {
+            throw std::bad_alloc();
+        }
+        void* result = base_ + used_;
+        used_ += granules * kGranule;
+        return result;
+    }
+
+    static void Deallocate(void* ptr, size_t size) {
+        size_t granules = Granules(size);
+        if (granules >= free_.size()) {
+            free_.resize(granules + 1, 0);
+        }
+        *static_cast<uint32_t*>(ptr) = free_[granules];
+        free_[granules] = Encode(ptr);
+    }
+
+    // Offset 0 is the null pointer: the first granule is never handed out. Anything else has to
+    // come from this arena, or the offset would decode to unrelated memory: throws
+    // `std::out_of_range` otherwise, in every build.
+    static uint32_t Offset(const void* ptr) {
+        if (ptr == nullptr) {
+            return 0;
+        }
+        if (!Contains(ptr)) {
+            throw std::out_of_range("Pointer outside of the arena");
+        }
+        return Encode(ptr);
+    }
+    // The decoded pointer is kept in a register, like a stored 64-bit pointer, instead of being
+    // folded into every access as base + offset. A copy and a release of the same counter then
+    // use the same address form, which the CPU forwards between as it does for `SharedPtr`.
+    static void* Address(uint32_t offset) {
+        if (offset == 0) {
+            return nullptr;
+        }
+        char* ptr = base_ + size_t{offset} * kGranule;
+#if defined(__GNUC__) || defined(__clang__)
+        asm("" : "+r"(ptr));
+#endif
+        return ptr;
+    }
+    static bool Contains(const void* ptr) {
+        auto* byte = static_cast<const char*>(ptr);
+        return base_ != nullptr && byte >= base_ + kGranule && byte < base_ + used_;
+    }
+
+    // Bytes handed out so far, including those on free lists.
+    static size_t Used() {
+        return used_ - kGranule;
+    }
+
+private:
+    static uint32_t Encode(const void* ptr) {
+        return static_cast<uint32_t>((static_cast<const char*>(ptr) - base_) / kGranule);
+    }
+    static size_t Granules(size_t size) {
+        return size == 0 ? 1 : (size + kGranule - 1) / kGranule;
+    }
+
+    static inline char* base_ = nullptr;
+    static inline size_t used_ = kGranule;
+    static inline size_t capacity_ = 0;
+    // Head offset of the free list for each size in granules.
+    static inline std::vector<uint32_t> free_;
+};
+
+// `Deleter` for `RefCounted` objects made by `MakeOffsetIntrusive`. Uses the static type, so the
+// object has to be destroyed as the type it was created with.
+template <typename Tag = DefaultArena>
+struct ArenaDelete {
+    template <typename T>
+    static void Destroy(T* object) {
+        object->~T();
+        Arena<Tag>::Deallocate(object, sizeof(T));
+    }
+};
+
+// Whether `T` is destroyed through `ArenaDelete<Tag>`, i.e. goes back to the arena it came from.
+template <typename Tag, typename Derived, typename Counter>
+std::true_type ReleasesToArena(const RefCounted<Derived, Counter, ArenaDelete<Tag>>*);
+template <typename Tag>
+std::false_type ReleasesToArena(const void*);
+
+template <typename T, typename Tag>
+inline constexpr bool kReleasesToArena =
+    decltype(ReleasesToArena<Tag>(static_cast<T*>(nullptr)))::value;
+
+// Control block made by `MakeOffsetShared`: goes back to the arena instead of the heap.
+template <typename T, typename Tag>
+class ArenaControlBlock : public ControlBlockWithObject<T> {
+public:
+    using ControlBlockWithObject<T>::ControlBlockWithObject;
+
+    void DeleteBlock() override {
+        this->~ArenaControlBlock();
+        Arena<Tag>::Deallocate(this, sizeof(ArenaControlBlock));
+    }
+};
+
+template <typename T, typename Tag = DefaultArena>
+class OffsetIntrusivePtr {
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    OffsetIntrusivePtr() = default;
+    OffsetIntrusivePtr(std::nullptr_t) {
+    }
+    explicit OffsetIntrusivePtr(T* ptr) : offset_(Arena<Tag>::Offset(ptr)) {
+        static_assert(kReleasesToArena<T, Tag>, "The deleter has to be ArenaDelete<Tag>");
+        if (ptr != nullptr) {
+            ptr->IncRef();
+        }
+    }
+    OffsetIntrusivePtr(T* ptr, AdoptRef) : offset_(Arena<Tag>::Offset(ptr)) {
+        static_assert(kReleasesToArena<T, Tag>, "The deleter has to be ArenaDelete<Tag>");
+    }
+    // `ptr` lets go only once the offset is known, so it keeps its reference if that throws.
+    explicit OffsetIntrusivePtr(IntrusivePtr<T> ptr) : offset_(Arena<Tag>::Offset(ptr.Get())) {
+        static_assert(kReleasesToArena<T, Tag>, "The deleter has to be ArenaDelete<Tag>");
+        [[maybe_unused]] T* adopted = ptr.Detach();
+    }
+
+    OffsetIntrusivePtr(const OffsetIntrusivePtr& other) : offset_(other.offset_) {
+        if (T* ptr = Get()) {
+            ptr->IncRef();
+        }
+    }
+    OffsetIntrusivePtr(OffsetIntrusivePtr&& other) : offset_(std::exchange(other.offset_, 0)) {
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    OffsetIntrusivePtr& operator=(const OffsetIntrusivePtr& other) {
+        OffsetIntrusivePtr(other).Swap(*this);
+        return *this;
+    }
+    OffsetIntrusivePtr& operator=(OffsetIntrusivePtr&& other) {
+        OffsetIntrusivePtr(std::move(other)).Swap(*this);
+        return *this;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~OffsetIntrusivePtr() {
+        Reset();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    void Reset() {
+        if (T* old = Decode(std::exchange(offset_, 0))) {
+            old->DecRef();
+        }
+    }
+    void Swap(OffsetIntrusivePtr& other) {
+        std::swap(offset_, other.offset_);
+    }
+    // Hands the reference over to a full-width `IntrusivePtr`.
+    IntrusivePtr<T> Widen() && {
+        return IntrusivePtr<T>(Decode(std::exchange(offset_, 0)), AdoptRef{});
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    T* Get() const {
+        return Decode(offset_);
+    }
+    T& operator*() const {
+        return *Get();
+    }
+    T* operator->() const {
+        return Get();
+    }
+    uint32_t Offset() const {
+        return offset_;
+    }
+    size_t UseCount() const {
+        T* ptr = Get();
+        return ptr == nullptr ? 0 : ptr->RefCount();
+    }
+    explicit operator bool() const {
+        return offset_ != 0;
+    }
+
+private:
+    static T* Decode(uint32_t offset) {
+        return static_cast<T*>(Arena<Tag>::Address(offset));
+    }
+
+    uint32_t offset_ = 0;
+};
+
+// Two offsets, like the two pointers of `SharedPtr`, so aliasing works as long as the object and
+// its control block are both in the arena. Released through a `SharedPtr`, and `Widen()` turns it
+// into one, e.g. to take a `WeakPtr`.
+template <typename T, typename Tag = DefaultArena>
+class OffsetSharedPtr {
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    OffsetSharedPtr() = default;
+    OffsetSharedPtr(std::nullptr_t) {
+    }
+    // Both the object and its block have to be in the arena, as `MakeOffsetShared` puts them:
+    // throws `std::out_of_range` otherwise, and `ptr` keeps its reference.
+    explicit OffsetSharedPtr(SharedPtr<T> ptr)
+        : ptr_(Arena<Tag>::Offset(ptr.ptr_)), cb_(Arena<Tag>::Offset(ArenaBlock(ptr))) {
+        ptr.ptr_ = nullptr;
+        ptr.cb_ = nullptr;
+    }
+
+    OffsetSharedPtr(const OffsetSharedPtr& other) : ptr_(other.ptr_), cb_(other.cb_) {
+        if (ControlBlockBase* cb = Block()) {
+            cb->strong_counter_++;
+        }
+    }
+    OffsetSharedPtr(OffsetSharedPtr&& other)
+        : ptr_(std::exchange(other.ptr_, 0)), cb_(std::exchange(other.cb_, 0)) {
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    OffsetSharedPtr& operator=(const OffsetSharedPtr& other) {
+        OffsetSharedPtr(other).Swap(*this);
+        return *this;
+    }
+    OffsetSharedPtr& operator=(OffsetSharedPtr&& other) {
+        OffsetSharedPtr(std::move(other)).Swap(*this);
+        return *this;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~OffsetSharedPtr() {
+        Reset();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    // Releases in place, unless the cycle collector has to hear about it: the block is decoded
+    // once and the last reference goes straight to `SharedPtr::Release`.
+    void Reset() {
+        if constexpr (SharedPtr<T>::kCollectable) {
+            std::move(*this).Widen();
+        } else {
+            if (ControlBlockBase* cb = Block(); cb != nullptr && --cb->strong_counter_ == 0) {
+                SharedPtr<T>::Release(cb, 0);
+            }
+            ptr_ = 0;
+            cb_ = 0;
+        }
+    }
+    void Swap(OffsetSharedPtr& other) {
+        std::swap(ptr_, other.ptr_);
+        std::swap(cb_, other.cb_);
+    }
+    // Hands the reference over to a full-width `SharedPtr`.
+    SharedPtr<T> Widen() && {
+        SharedPtr<T> owner;
+        owner.ptr_ = Get();
+        owner.cb_ = Block();
+        ptr_ = 0;
+        cb_ = 0;
+        return owner;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    T* Get() const {
+        return static_cast<T*>(Arena<Tag>::Address(ptr_));
+    }
+    T& operator*() const {
+        return *Get();
+    }
+    T* operator->() const {
+        return Get();
+    }
+    size_t UseCount() const {
+        ControlBlockBase* cb = Block();
+        return cb == nullptr ? 0 : cb->strong_counter_;
+    }
+    explicit operator bool() const {
+        return ptr_ != 0;
+    }
+
+private:
+    template <typename Y, typename ArenaTag, typename... Args>
+    friend OffsetSharedPtr<Y, ArenaTag> MakeOffsetShared(Args&&... args);
+
+    explicit OffsetSharedPtr(ArenaControlBlock<T, Tag>* block)
+        : ptr_(Arena<Tag>::Offset(block->ptr_)), cb_(Arena<Tag>::Offset(block)) {
+        SharedPtr<T> owner;
+        owner.cb_ = block;
+        owner.AttachThis(block->ptr_);
+        owner.cb_ = nullptr;
+    }
+
+    ControlBlockBase* Block() const {
+        return static_cast<ControlBlockBase*>(Arena<Tag>::Address(cb_));
+    }
+    // A pointer adopted from `new` has no block yet, and is not given a heap one here.
+    static const ControlBlockBase* ArenaBlock(const SharedPtr<T>& ptr) {
+        if (SharedPtr<T>::Deferred(ptr.cb_)) {
+            throw std::out_of_range("Pointer outside of the arena");
+        }
+        return ptr.cb_;
+    }
+
+    uint32_t ptr_ = 0;
+    uint32_t cb_ = 0;
+};
+
+template <typename T, typename Tag = DefaultArena, typename... Args>
+OffsetIntrusivePtr<T, Tag> MakeOffsetIntrusive(Args&&... args) {
+    static_assert(alignof(T) <= Arena<Tag>::kGranule, "Over-aligned types are not supported");
+    static_assert(kReleasesToArena<T, Tag>, "The deleter has to be ArenaDelete<Tag>");
+    void* memory = Arena<Tag>::Allocate(sizeof(T));
+    T* object;
+    try {
+        object = new (memory) T(std::forward<Args>(args)...);
+    } catch (...) {
+        Arena<Tag>::Deallocate(memory, sizeof(T));
+        throw;
+    }
+    return OffsetIntrusivePtr<T, Tag>(object);
+}
+
+template <typename T, typename Tag = DefaultArena, typename... Args>
+OffsetSharedPtr<T, Tag> MakeOffsetShared(Args&&... args) {
+    using Block = ArenaControlBlock<T, Tag>;
+    static_assert(alignof(Block) <= Arena<Tag>::kGranule, "Over-aligned types are not supported");
+    void* memory = Arena<Tag>::Allocate(sizeof(Block));
+    Block* block;
+    try {
+        block = new (memory) Block(std::forward<Args>(args)...);
+    } catch (...) {
+        Arena<Tag>::Deallocate(memory, sizeof(Block));
+        throw;
+    }
+    return OffsetSharedPtr<T, Tag>(block);
+}
@@ -0,0 +1,1137 @@
+#include "arena.h"
+#include "cow.h"
+#include "intrusive.h"
+#include "mapped_file.h"
+#include "owner.h"
+#include "persistent.h"
+#include "pool.h"
+#include "shared.h"
+#include "shared_buffer.h"
+#include "shared_string.h"
+#include "shm.h"
+#include "slot_map.h"
+#include "std_interop.h"
+#include "tagged.h"
+#include "trailing.h"
+#include "unique.h"
+#include "weak.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <map>
+#include <span>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <malloc.h>
+#include <unistd.h>
+
+///================================================================================================///
+
+// Keeps the optimizer from discarding `value`.
+template <typename T>
+inline void DoNotOptimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Runs `body` once and reports the time per operation.
+template <typename F>
+void Measure(const char* name, size_t operations, F&& body) {
+    auto start = std::chrono::steady_clock::now();
+    body();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    double ns = std::chrono::duration<double, std::nano>(elapsed).count();
+    std::printf("%-48s %8.2f ns/op\n", name, ns / static_cast<double>(operations));
+}
+
+///================================================================================================///
+
+void BenchBatch() {
+    constexpr size_t kFanOut = 64;
+    constexpr size_t kRounds = 20000;
+
+    auto source = MakeShared<int>(42);
+    std::vector<SharedPtr<int>> out(kFanOut);
+    Measure("fan-out + clear: element-wise", kFanOut * kRounds, [&] {
+        for (size_t round = 0; round < kRounds; ++round) {
+            for (auto& slot : out) {
+                slot = source;
+            }
+            DoNotOptimize(out.data());
+            for (auto& slot : out) {
+                slot.Reset();
+            }
+        }
+    });
+    Measure("fan-out + clear: ShareN + ReleaseAll", kFanOut * kRounds, [&] {
+        for (size_t round = 0; round < kRounds; ++round) {
+            ShareN(source, std::span(out));
+            DoNotOptimize(out.data());
+            ReleaseAll(std::span(out));
+        }
+    });
+
+    constexpr size_t kBlocks = 16;
+    std::vector<SharedPtr<int>> owners;
+    for (size_t i = 0; i < kBlocks; ++i) {
+        owners.push_back(MakeShared<int>(static_cast<int>(i)));
+    }
+    std::vector<SharedPtr<int>> ptrs(kFanOut * kBlocks);
+    auto fill = [&] {
+        for (size_t i = 0; i < ptrs.size(); ++i) {
+            ptrs[i] = owners[i % kBlocks];
+        }
+    };
+    constexpr size_t kReleaseRounds = 2000;
+    Measure("bulk release: element-wise Reset", ptrs.size() * kReleaseRounds, [&] {
+        for (size_t round = 0; round < kReleaseRounds; ++round) {
+            fill();
+            for (auto& ptr : ptrs) {
+                ptr.Reset();
+            }
+        }
+    });
+    Measure("bulk release: ReleaseAll", ptrs.size() * kReleaseRounds, [&] {
+        for (size_t round = 0; round < kReleaseRounds; ++round) {
+            fill();
+            ReleaseAll(std::span(ptrs));
+        }
+    });
+
+    // Many distinct blocks, visited in an order unrelated to their addresses.
+    constexpr size_t kColdBlocks = 1 << 16;
+    std::vector<SharedPtr<int>> cold_owners;
+    for (size_t i = 0; i < kColdBlocks; ++i) {
+        cold_owners.push_back(MakeShared<int>(static_cast<int>(i)));
+    }
+    std::vector<SharedPtr<int>> cold(kColdBlocks * 2);
+    auto fill_cold = [&] {
+        for (size_t i = 0; i < kColdBlocks; ++i) {
+            size_t owner = (i * 7919) % kColdBlocks;
+            cold[2 * i] = cold_owners[owner];
+            cold[2 * i + 1] = cold_owners[owner];
+        }
+    };
+    constexpr size_t kColdRounds = 20;
+    Measure("bulk release, cold blocks: element-wise Reset", cold.size() * kColdRounds, [&] {
+        for (size_t round = 0; round < kColdRounds; ++round) {
+            fill_cold();
+            for (auto& ptr : cold) {
+                ptr.Reset();
+            }
+        }
+    });
+    Measure("bulk release, cold blocks: ReleaseAll", cold.size() * kColdRounds, [&] {
+        for (size_t round = 0; round < kColdRounds; ++round) {
+            fill_cold();
+            ReleaseAll(std::span(cold));
+        }
+    });
+}
+
+///================================================================================================///
+
+void BenchOwnerMap() {
+    constexpr size_t kKeys = 1 << 16;
+    constexpr size_t kLookupRounds = 8;
+    std::vector<SharedPtr<int>> keys;
+    for (size_t i = 0; i < kKeys; ++i) {
+        keys.push_back(MakeShared<int>(static_cast<int>(i)));
+    }
+
+    OwnerMap<SharedPtr<int>, size_t> owner_map;
+    Measure("OwnerMap: insert", kKeys, [&] {
+        for (size_t i = 0; i < kKeys; ++i) {
+            owner_map[keys[i]] = i;
+        }
+    });
+    Measure("OwnerMap: lookup", kKeys * kLookupRounds, [&] {
+        size_t sum = 0;
+        for (size_t round = 0; round < kLookupRounds; ++round) {
+            for (size_t i = 0; i < kKeys; ++i) {
+                sum += *owner_map.Find(keys[(i * 7919) % kKeys]);
+            }
+        }
+        DoNotOptimize(sum);
+    });
+
+    std::unordered_map<SharedPtr<int>, size_t, OwnerHash, OwnerEqual> std_map;
+    Measure("std::unordered_map: insert", kKeys, [&] {
+        for (size_t i = 0; i < kKeys; ++i) {
+            std_map[keys[i]] = i;
+        }
+    });
+    Measure("std::unordered_map: lookup", kKeys * kLookupRounds, [&] {
+        size_t sum = 0;
+        for (size_t round = 0; round < kLookupRounds; ++round) {
+            for (size_t i = 0; i < kKeys; ++i) {
+                sum += std_map.find(keys[(i * 7919) % kKeys])->second;
+            }
+        }
+        DoNotOptimize(sum);
+    });
+}
+
+///================================================================================================///
+
+struct PlainObject {
+    int value = 0;
+};
+
+struct SelfAware : public EnableSharedFromThis<SelfAware> {
+    int value = 0;
+};
+
+void BenchSharedFromThis() {
+    constexpr size_t kObjects = 1 << 20;
+    Measure("MakeShared + destroy: plain type", kObjects, [&] {
+        for (size_t i = 0; i < kObjects; ++i) {
+            auto p = MakeShared<PlainObject>();
+            DoNotOptimize(p.Get());
+        }
+    });
+    Measure("MakeShared + destroy: EnableSharedFromThis", kObjects, [&] {
+        for (size_t i = 0; i < kObjects; ++i) {
+            auto p = MakeShared<SelfAware>();
+            DoNotOptimize(p.Get());
+        }
+    });
+    Measure("SharedPtr(new T) + destroy: plain type", kObjects, [&] {
+        for (size_t i = 0; i < kObjects; ++i) {
+            SharedPtr<PlainObject> p(new PlainObject);
+            DoNotOptimize(p.Get());
+        }
+    });
+    Measure("SharedPtr(new T) + copy + destroy: plain type", kObjects, [&] {
+        for (size_t i = 0; i < kObjects; ++i) {
+            SharedPtr<PlainObject> p(new PlainObject);
+            SharedPtr<PlainObject> copy(p);
+            DoNotOptimize(copy.Get());
+        }
+    });
+    Measure("SharedPtr(new T) + destroy: EnableSharedFromThis", kObjects, [&] {
+        for (size_t i = 0; i < kObjects; ++i) {
+            SharedPtr<SelfAware> p(new SelfAware);
+            DoNotOptimize(p.Get());
+        }
+    });
+    auto p = MakeShared<SelfAware>();
+    Measure("SharedFromThis", kObjects, [&] {
+        for (size_t i = 0; i < kObjects; ++i) {
+            auto self = p->SharedFromThis();
+            DoNotOptimize(self.Get());
+        }
+    });
+}
+
+///================================================================================================///
+
+struct Message {
+    virtual ~Message() = default;
+};
+
+struct TextMessage : Message {
+    int length = 0;
+};
+
+void BenchCasts() {
+    constexpr size_t kCasts = 1 << 22;
+    SharedPtr<Message> message = MakeShared<TextMessage>();
+    Measure("DynamicPointerCast: copy", kCasts, [&] {
+        for (size_t i = 0; i < kCasts; ++i) {
+            auto text = DynamicPointerCast<TextMessage>(message);
+            DoNotOptimize(text.Get());
+        }
+    });
+    Measure("DynamicPointerCast: move and back", kCasts, [&] {
+        for (size_t i = 0; i < kCasts; ++i) {
+            auto text = DynamicPointerCast<TextMessage>(std::move(message));
+            DoNotOptimize(text.Get());
+            message = std::move(text);
+        }
+    });
+    Measure("StaticPointerCast: copy", kCasts, [&] {
+        for (size_t i = 0; i < kCasts; ++i) {
+            auto text = StaticPointerCast<TextMessage>(message);
+            DoNotOptimize(text.Get());
+        }
+    });
+    Measure("StaticPointerCast: move and back", kCasts, [&] {
+        for (size_t i = 0; i < kCasts; ++i) {
+            auto text = StaticPointerCast<TextMessage>(std::move(message));
+            DoNotOptimize(text.Get());
+            message = std::move(text);
+        }
+    });
+}
+
+///================================================================================================///
+
+struct IntrusiveObject : public SimpleRefCounted<IntrusiveObject> {
+    int value = 0;
+};
+
+void BenchIntrusive() {
+    constexpr size_t kOperations = 1 << 24;
+    auto object = MakeIntrusive<IntrusiveObject>();
+    Measure("IntrusivePtr: copy + destroy", kOperations, [&] {
+        for (size_t i = 0; i < kOperations; ++i) {
+            IntrusivePtr<IntrusiveObject> copy(object);
+            DoNotOptimize(copy.Get());
+        }
+    });
+    IntrusivePtr<IntrusiveObject> other;
+    Measure("IntrusivePtr: move there and back", kOperations, [&] {
+        for (size_t i = 0; i < kOperations; ++i) {
+            other = std::move(object);
+            DoNotOptimize(other.Get());
+            object = std::move(other);
+        }
+    });
+}
+
+///================================================================================================///
+
+template <typename Counter>
+struct Counted : public RefCounted<Counted<Counter>, Counter, DefaultDelete> {
+    int value = 0;
+};
+
+template <typename Counter>
+void BenchCounter(const char* name) {
+    constexpr size_t kOperations = 1 << 24;
+    auto object = MakeIntrusive<Counted<Counter>>();
+    Measure(name, kOperations, [&] {
+        for (size_t i = 0; i < kOperations; ++i) {
+            IntrusivePtr<Counted<Counter>> copy(object);
+            DoNotOptimize(copy.Get());
+        }
+    });
+}
+
+void BenchCounterPolicies() {
+    BenchCounter<SimpleCounter>("inc/dec: SimpleCounter");
+    BenchCounter<SimpleCounter32>("inc/dec: SimpleCounter32");
+    BenchCounter<SimpleCounter16>("inc/dec: SimpleCounter16");
+    BenchCounter<AtomicCounter>("inc/dec: AtomicCounter");
+    BenchCounter<AtomicCounter32>("inc/dec: AtomicCounter32");
+
+    constexpr size_t kThreads = 4;
+    constexpr size_t kOperations = 1 << 21;
+    auto object = MakeIntrusive<Counted<AtomicCounter>>();
+    Measure("inc/dec: AtomicCounter, 4 threads contended", kThreads * kOperations, [&] {
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < kThreads; ++t) {
+            threads.emplace_back([&object] {
+                for (size_t i = 0; i < kOperations; ++i) {
+                    IntrusivePtr<Counted<AtomicCounter>> copy(object);
+                    DoNotOptimize(copy.Get());
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    });
+}
+
+///================================================================================================///
+
+struct PooledRequest {
+    PooledRequest() : buffer(4096) {
+    }
+    void Reset() {
+        buffer.front() = 0;
+    }
+    std::vector<char> buffer;
+};
+
+void BenchPool() {
+    constexpr size_t kOperations = 1 << 20;
+    Measure("MakeShared: 4 KiB request", kOperations, [&] {
+        for (size_t i = 0; i < kOperations; ++i) {
+            auto request = MakeShared<PooledRequest>();
+            DoNotOptimize(request.Get());
+        }
+    });
+    ObjectPool<PooledRequest> pool(16);
+    Measure("ObjectPool: 4 KiB request", kOperations, [&] {
+        for (size_t i = 0; i < kOperations; ++i) {
+            auto request = pool.Acquire();
+            DoNotOptimize(request.Get());
+        }
+    });
+}
+
+///================================================================================================///
+
+void BenchUniquePromotion() {
+    constexpr size_t kOperations = 1 << 22;
+    Measure("MakeUnique + promote to SharedPtr", kOperations, [&] {
+        for (size_t i = 0; i < kOperations; ++i) {
+            SharedPtr<int> shared(MakeUnique<int>(1));
+            DoNotOptimize(shared.Get());
+        }
+    });
+    Measure("MakeUniqueShareable + promote to SharedPtr", kOperations, [&] {
+        for (size_t i = 0; i < kOperations; ++i) {
+            SharedPtr<int> shared(MakeUniqueShareable<int>(1));
+            DoNotOptimize(shared.Get());
+        }
+    });
+}
+
+///================================================================================================///
+
+struct HybridObject : public SharedRefCounted<HybridObject> {
+    int value = 0;
+};
+
+void BenchInterop() {
+    constexpr size_t kOperations = 1 << 24;
+    auto intrusive = MakeIntrusive<HybridObject>();
+    Measure("IntrusivePtr copy + destroy: SharedRefCounted", kOperations, [&] {
+        for (size_t i = 0; i < kOperations; ++i) {
+            IntrusivePtr<HybridObject> copy(intrusive);
+            DoNotOptimize(copy.Get());
+        }
+    });
+    SharedPtr<HybridObject> shared(intrusive);
+    Measure("SharedPtr copy + destroy: SharedRefCounted", kOperations, [&] {
+        for (size_t i = 0; i < kOperations; ++i) {
+            SharedPtr<HybridObject> copy(shared);
+            DoNotOptimize(copy.Get());
+        }
+    });
+    auto plain = MakeShared<PlainObject>();
+    Measure("SharedPtr copy + destroy: MakeShared", kOperations, [&] {
+        for (size_t i = 0; i < kOperations; ++i) {
+            SharedPtr<PlainObject> copy(plain);
+            DoNotOptimize(copy.Get());
+        }
+    });
+    Measure("IntrusivePtr -> SharedPtr -> IntrusivePtr", kOperations, [&] {
+        for (size_t i = 0; i < kOperations; ++i) {
+            IntrusivePtr<HybridObject> back(SharedPtr<HybridObject>{intrusive});
+            DoNotOptimize(back.Get());
+        }
+    });
+}
+
+///================================================================================================///
+
+void BenchStdInterop() {
+    constexpr size_t kOperations = 1 << 22;
+    auto ours = MakeShared<PlainObject>();
+    Measure("ToStd: bridge a SharedPtr", kOperations, [&] {
+        for (size_t i = 0; i < kOperations; ++i) {
+            auto theirs = ToStd(ours);
+            DoNotOptimize(theirs.get());
+        }
+    });
+    auto theirs = std::make_shared<PlainObject>();
+    Measure("FromStd: wrap a std::shared_ptr", kOperations, [&] {
+        for (size_t i = 0; i < kOperations; ++i) {
+            auto wrapped = FromStd(theirs);
+            DoNotOptimize(wrapped.Get());
+        }
+    });
+    auto bridged = ToStd(ours);
+    Measure("FromStd: unwrap a bridged pointer", kOperations, [&] {
+        for (size_t i = 0; i < kOperations; ++i) {
+            auto back = FromStd(bridged);
+            DoNotOptimize(back.Get());
+        }
+    });
+    auto wrapped = FromStd(theirs);
+    Measure("ToStd: unwrap a wrapped pointer", kOperations, [&] {
+        for (size_t i = 0; i < kOperations; ++i) {
+            auto back = ToStd(wrapped);
+            DoNotOptimize(back.get());
+        }
+    });
+    Measure("std::shared_ptr copy + destroy (reference)", kOperations, [&] {
+        for (size_t i = 0; i < kOperations; ++i) {
+            auto copy = theirs;
+            DoNotOptimize(copy.get());
+        }
+    });
+}
+
+///================================================================================================///
+
+template <typename Base>
+struct ChainNode : public Base {
+    SharedPtr<ChainNode> next;
+};
+
+template <typename Base>
+void BenchChain(const char* name) {
+    constexpr size_t kLength = 50000;
+    constexpr size_t kRounds = 20;
+    double total = 0;
+    for (size_t round = 0; round < kRounds; ++round) {
+        SharedPtr<ChainNode<Base>> head;
+        for (size_t i = 0; i < kLength; ++i) {
+            auto node = MakeShared<ChainNode<Base>>();
+            node->next = std::move(head);
+            head = std::move(node);
+        }
+        auto start = std::chrono::steady_clock::now();
+        head.Reset();
+        total += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start)
+                     .count();
+    }
+    std::printf("%-48s %8.2f ns/op\n", name, total / (kRounds * kLength));
+}
+
+struct NoTeardown {};
+
+void BenchTeardown() {
+    BenchChain<NoTeardown>("chain teardown: recursive");
+    BenchChain<IterativeTeardown>("chain teardown: iterative");
+}
+
+///================================================================================================///
+
+struct CycleNode : public Collectable {
+    void Trace(CycleTracer& tracer) const override {
+        tracer(next);
+    }
+
+    SharedPtr<CycleNode> next;
+};
+
+struct PlainNode {
+    SharedPtr<PlainNode> next;
+};
+
+void BenchCycles() {
+    constexpr size_t kOperations = 1 << 22;
+    auto plain = MakeShared<PlainNode>();
+    Measure("SharedPtr copy + destroy (plain)", kOperations, [&] {
+        for (size_t i = 0; i < kOperations; ++i) {
+            auto copy = plain;
+            DoNotOptimize(copy.Get());
+        }
+    });
+    auto node = MakeShared<CycleNode>();
+    Measure("SharedPtr copy + destroy (collectable)", kOperations, [&] {
+        for (size_t i = 0; i < kOperations; ++i) {
+            auto copy = node;
+            DoNotOptimize(copy.Get());
+        }
+    });
+    CollectCycles();
+
+    constexpr size_t kRing = 1000;
+    constexpr size_t kRings = 200;
+    double total = 0;
+    for (size_t round = 0; round < kRings; ++round) {
+        auto head = MakeShared<CycleNode>();
+        auto tail = head;
+        for (size_t i = 1; i < kRing; ++i) {
+            tail->next = MakeShared<CycleNode>();
+            tail = tail->next;
+        }
+        tail->next = head;
+        tail.Reset();
+        head.Reset();
+        auto start = std::chrono::steady_clock::now();
+        CollectCycles();
+        total += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start)
+                     .count();
+    }
+    std::printf("%-48s %8.2f ns/op\n", "CollectCycles: per ring member", total / (kRings * kRing));
+}
+
+///================================================================================================///
+
+void BenchSlotMap() {
+    constexpr size_t kObjects = 1 << 16;
+    constexpr size_t kRounds = 16;
+    SlotMap<int> map;
+    std::vector<SlotHandle<int>> handles;
+    std::vector<WeakPtr<int>> weaks;
+    for (size_t i = 0; i < kObjects; ++i) {
+        handles.push_back(map.Emplace(static_cast<int>(i)));
+        weaks.push_back(map.Lock(handles.back()));
+    }
+    Measure("WeakPtr::Lock + read", kObjects * kRounds, [&] {
+        size_t sum = 0;
+        for (size_t round = 0; round < kRounds; ++round) {
+            for (size_t i = 0; i < kObjects; ++i) {
+                sum += *weaks[(i * 7919) % kObjects].Lock();
+            }
+        }
+        DoNotOptimize(sum);
+    });
+    Measure("SlotMap::Lock + read", kObjects * kRounds, [&] {
+        size_t sum = 0;
+        for (size_t round = 0; round < kRounds; ++round) {
+            for (size_t i = 0; i < kObjects; ++i) {
+                sum += *map.Lock(handles[(i * 7919) % kObjects]);
+            }
+        }
+        DoNotOptimize(sum);
+    });
+    Measure("SlotMap::Get + read", kObjects * kRounds, [&] {
+        size_t sum = 0;
+        for (size_t round = 0; round < kRounds; ++round) {
+            for (size_t i = 0; i < kObjects; ++i) {
+                sum += *map.Get(handles[(i * 7919) % kObjects]);
+            }
+        }
+        DoNotOptimize(sum);
+    });
+    weaks.clear();
+    Measure("SlotMap: erase + emplace", kObjects, [&] {
+        for (size_t i = 0; i < kObjects; ++i) {
+            auto& handle = handles[(i * 7919) % kObjects];
+            map.Erase(handle);
+            handle = map.Emplace(static_cast<int>(i));
+        }
+    });
+}
+
+///================================================================================================///
+
+struct MarkedEdge {
+    IntrusivePtr<IntrusiveObject> target;
+    bool mark = false;
+};
+
+void BenchTagged() {
+    constexpr size_t kEdges = 1 << 20;
+    constexpr size_t kRounds = 16;
+    auto object = MakeIntrusive<IntrusiveObject>();
+    std::vector<MarkedEdge> separate(kEdges);
+    std::vector<TaggedIntrusivePtr<IntrusiveObject, 1>> tagged(kEdges);
+    for (size_t i = 0; i < kEdges; ++i) {
+        separate[i] = {object, i % 3 == 0};
+        tagged[i] = TaggedIntrusivePtr<IntrusiveObject, 1>(object.Get(), i % 3 == 0);
+    }
+    std::printf("edge size: tag word %zu bytes, tagged pointer %zu bytes\n", sizeof(MarkedEdge),
+                sizeof(tagged[0]));
+    Measure("edge scan: separate mark", kEdges * kRounds, [&] {
+        size_t marked = 0;
+        for (size_t round = 0; round < kRounds; ++round) {
+            for (const auto& edge : separate) {
+                marked += edge.mark ? edge.target->value : 0;
+            }
+        }
+        DoNotOptimize(marked);
+    });
+    Measure("edge scan: tagged pointer", kEdges * kRounds, [&] {
+        size_t marked = 0;
+        for (size_t round = 0; round < kRounds; ++round) {
+            for (const auto& edge : tagged) {
+                marked += edge.Tag() != 0 ? edge->value : 0;
+            }
+        }
+        DoNotOptimize(marked);
+    });
+    Measure("TaggedIntrusivePtr: copy + destroy", kEdges * kRounds, [&] {
+        for (size_t i = 0; i < kEdges * kRounds; ++i) {
+            auto copy = tagged[0];
+            DoNotOptimize(copy.Get());
+        }
+    });
+}
+
+///================================================================================================///
+
+struct BenchArena {};
+
+struct WideVertex : public SimpleRefCounted<WideVertex> {
+    IntrusivePtr<WideVertex> edges[4];
+    uint32_t value = 0;
+};
+
+struct NarrowVertex : public RefCounted<NarrowVertex, SimpleCounter32, ArenaDelete<BenchArena>> {
+    OffsetIntrusivePtr<NarrowVertex, BenchArena> edges[4];
+    uint32_t value = 0;
+};
+
+// Random graph with four out-edges per vertex, then a walk that follows one edge per step.
+template <typename Vertex, typename Make>
+void BenchGraph(const char* name, Make make) {
+    constexpr size_t kVertices = 1 << 20;
+    constexpr size_t kSteps = 1 << 24;
+    std::vector<decltype(make())> vertices;
+    vertices.reserve(kVertices);
+    for (size_t i = 0; i < kVertices; ++i) {
+        vertices.push_back(make());
+        vertices.back()->value = static_cast<uint32_t>(i);
+    }
+    uint64_t state = 1;
+    for (auto& vertex : vertices) {
+        for (auto& edge : vertex->edges) {
+            state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+            edge = vertices[(state >> 33) % kVertices];
+        }
+    }
+    std::printf("%s: %zu bytes per vertex\n", name, sizeof(Vertex));
+    Measure(name, kSteps, [&] {
+        const Vertex* vertex = vertices[0].Get();
+        uint32_t sum = 0;
+        for (size_t i = 0; i < kSteps; ++i) {
+            sum += vertex->value;
+            vertex = vertex->edges[sum & 3].Get();
+        }
+        DoNotOptimize(sum);
+    });
+    for (auto& vertex : vertices) {
+        for (auto& edge : vertex->edges) {
+            edge.Reset();
+        }
+    }
+}
+
+void BenchOffset() {
+    BenchGraph<WideVertex>("graph walk: IntrusivePtr", [] { return MakeIntrusive<WideVertex>(); });
+    BenchGraph<NarrowVertex>("graph walk: OffsetIntrusivePtr",
+                             [] { return MakeOffsetIntrusive<NarrowVertex, BenchArena>(); });
+    std::printf("edge size: SharedPtr %zu bytes, OffsetSharedPtr %zu bytes\n",
+                sizeof(SharedPtr<int>), sizeof(OffsetSharedPtr<int, BenchArena>));
+    constexpr size_t kOperations = 1 << 24;
+    auto wide = MakeShared<int>();
+    Measure("SharedPtr: copy + destroy", kOperations, [&] {
+        for (size_t i = 0; i < kOperations; ++i) {
+            auto copy = wide;
+            DoNotOptimize(copy.Get());
+        }
+    });
+    auto narrow = MakeOffsetShared<int, BenchArena>();
+    Measure("OffsetSharedPtr: copy + destroy", kOperations, [&] {
+        for (size_t i = 0; i < kOperations; ++i) {
+            auto copy = narrow;
+            DoNotOptimize(copy.Get());
+        }
+    });
+}
+
+///================================================================================================///
+
+void BenchShm() {
+    constexpr size_t kOperations = 1 << 24;
+    std::string name = "/smartptr-bench-" + std::to_string(getpid());
+    auto shared = MakeShmShared<int>(name, 1);
+    Measure("ShmSharedPtr: copy + destroy", kOperations, [&] {
+        for (size_t i = 0; i < kOperations; ++i) {
+            auto copy = shared;
+            DoNotOptimize(copy.Get());
+        }
+    });
+    constexpr size_t kOpens = 1 << 12;
+    Measure("ShmSharedPtr: open + detach", kOpens, [&] {
+        for (size_t i = 0; i < kOpens; ++i) {
+            auto opened = OpenShmShared<int>(name);
+            DoNotOptimize(opened.Get());
+        }
+    });
+}
+
+///================================================================================================///
+
+// Sums one byte per page, so the cost is dominated by getting the file into memory.
+size_t TouchPages(std::span<const std::byte> bytes) {
+    size_t sum = 0;
+    for (size_t i = 0; i < bytes.size(); i += 4096) {
+        sum += static_cast<size_t>(bytes[i]);
+    }
+    return sum;
+}
+
+void BenchMappedFile() {
+    constexpr size_t kSize = size_t{128} << 20;
+    constexpr size_t kPages = kSize / 4096;
+    std::string path = "/tmp/smartptr-bench-" + std::to_string(getpid());
+    {
+        std::vector<std::byte> contents(kSize, std::byte{1});
+        std::FILE* file = std::fopen(path.c_str(), "wb");
+        std::fwrite(contents.data(), 1, contents.size(), file);
+        std::fclose(file);
+    }
+    Measure("file load: read() into a buffer (per page)", kPages, [&] {
+        std::vector<std::byte> buffer(kSize);
+        int fd = open(path.c_str(), O_RDONLY);
+        for (size_t done = 0; done < kSize;) {
+            ssize_t got = read(fd, buffer.data() + done, kSize - done);
+            if (got <= 0) {
+                break;
+            }
+            done += static_cast<size_t>(got);
+        }
+        close(fd);
+        DoNotOptimize(TouchPages(buffer));
+    });
+    Measure("file load: MapFileShared (per page)", kPages, [&] {
+        auto mapped = MapFileShared(path);
+        DoNotOptimize(TouchPages(mapped.Span()));
+    });
+    Measure("file load: MapFileShared + populate (per page)", kPages, [&] {
+        auto mapped = MapFileShared(path, {.populate = true});
+        DoNotOptimize(TouchPages(mapped.Span()));
+    });
+    auto mapped = MapFileShared(path);
+    constexpr size_t kViews = 1 << 20;
+    Measure("MappedFile::View", kViews, [&] {
+        for (size_t i = 0; i < kViews; ++i) {
+            auto view = mapped.View<uint64_t>((i * 8) % kSize);
+            DoNotOptimize(view.Get());
+        }
+    });
+    std::remove(path.c_str());
+}
+
+///================================================================================================///
+
+void BenchSharedBuffer() {
+    constexpr size_t kPacket = 1500;
+    constexpr size_t kOperations = 1 << 20;
+    std::vector<uint8_t> packet(kPacket, 7);
+    Measure("std::vector<uint8_t>: copy payload", kOperations, [&] {
+        for (size_t i = 0; i < kOperations; ++i) {
+            std::vector<uint8_t> payload(packet.begin() + 40, packet.end());
+            DoNotOptimize(payload.data());
+        }
+    });
+    auto buffer = SharedBuffer::Copy(std::as_bytes(std::span(packet)));
+    Measure("SharedBuffer: slice payload", kOperations, [&] {
+        for (size_t i = 0; i < kOperations; ++i) {
+            auto payload = buffer.Slice(40, kPacket - 40);
+            DoNotOptimize(payload.Data());
+        }
+    });
+    std::vector<std::byte> chunk(64, std::byte{1});
+    Measure("std::vector<uint8_t>: append 64 B x 16", kOperations, [&] {
+        for (size_t i = 0; i < kOperations; ++i) {
+            std::vector<uint8_t> message;
+            message.reserve(1024);
+            for (size_t j = 0; j < 16; ++j) {
+                auto* bytes = reinterpret_cast<const uint8_t*>(chunk.data());
+                message.insert(message.end(), bytes, bytes + chunk.size());
+            }
+            DoNotOptimize(message.data());
+        }
+    });
+    Measure("SharedBuffer: append 64 B x 16", kOperations, [&] {
+        for (size_t i = 0; i < kOperations; ++i) {
+            auto message = SharedBuffer::Allocate(1024);
+            for (size_t j = 0; j < 16; ++j) {
+                message.Append(chunk);
+            }
+            DoNotOptimize(message.Data());
+        }
+    });
+}
+
+///================================================================================================///
+
+struct EdgeList {
+    int vertex = 0;
+    std::vector<int> edges;
+};
+
+struct TrailingEdgeList : public TrailingArray<TrailingEdgeList, int> {
+    int vertex = 0;
+};
+
+void BenchTrailing() {
+    constexpr size_t kEdges = 8;
+    constexpr size_t kOperations = 1 << 20;
+    Measure("MakeShared + std::vector<int>(8)", kOperations, [&] {
+        for (size_t i = 0; i < kOperations; ++i) {
+            auto list = MakeShared<EdgeList>();
+            list->edges.resize(kEdges);
+            DoNotOptimize(list->edges.data());
+        }
+    });
+    Measure("MakeSharedWithTrailing<int>(8)", kOperations, [&] {
+        for (size_t i = 0; i < kOperations; ++i) {
+            auto list = MakeSharedWithTrailing<TrailingEdgeList, int>(kEdges);
+            DoNotOptimize(list->Trailing().data());
+        }
+    });
+
+    // Walking many small lists: the trailing elements share a cache line with the header.
+    constexpr size_t kLists = 1 << 16;
+    std::vector<SharedPtr<EdgeList>> separate;
+    std::vector<SharedPtr<TrailingEdgeList>> trailing;
+    for (size_t i = 0; i < kLists; ++i) {
+        separate.push_back(MakeShared<EdgeList>());
+        separate.back()->edges.assign(kEdges, 1);
+        trailing.push_back(MakeSharedWithTrailing<TrailingEdgeList, int>(kEdges));
+        std::fill(trailing.back()->Trailing().begin(), trailing.back()->Trailing().end(), 1);
+    }
+    constexpr size_t kRounds = 32;
+    Measure("sum 8 edges: header + std::vector", kLists * kRounds, [&] {
+        long sum = 0;
+        for (size_t round = 0; round < kRounds; ++round) {
+            for (const auto& list : separate) {
+                for (int edge : list->edges) {
+                    sum += edge;
+                }
+            }
+        }
+        DoNotOptimize(sum);
+    });
+    Measure("sum 8 edges: trailing array", kLists * kRounds, [&] {
+        long sum = 0;
+        for (size_t round = 0; round < kRounds; ++round) {
+            for (const auto& list : trailing) {
+                for (int edge : list->Trailing()) {
+                    sum += edge;
+                }
+            }
+        }
+        DoNotOptimize(sum);
+    });
+}
+
+///================================================================================================///
+
+template <typename Key, typename Map>
+void BenchStringKeys(const char* copy_name, const char* map_name, const char* find_name,
+                     const std::vector<Key>& keys) {
+    constexpr size_t kRounds = 64;
+    Measure(copy_name, keys.size() * kRounds, [&] {
+        for (size_t round = 0; round < kRounds; ++round) {
+            for (const Key& key : keys) {
+                Key copy = key;
+                DoNotOptimize(copy);
+            }
+        }
+    });
+    // A cache layer takes a copy of every entry of the layer below.
+    Map source;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        source.emplace(keys[i], static_cast<int>(i));
+    }
+    constexpr size_t kCopies = 16;
+    Measure(map_name, keys.size() * kCopies, [&] {
+        for (size_t copy = 0; copy < kCopies; ++copy) {
+            Map layer(source);
+            DoNotOptimize(layer.size());
+        }
+    });
+    Measure(find_name, keys.size() * kRounds, [&] {
+        long sum = 0;
+        for (size_t round = 0; round < kRounds; ++round) {
+            for (const Key& key : keys) {
+                sum += source.find(key)->second;
+            }
+        }
+        DoNotOptimize(sum);
+    });
+}
+
+void BenchSharedString() {
+    constexpr size_t kKeys = 1 << 12;
+    std::vector<std::string> strings;
+    std::vector<SharedString> shared;
+    for (size_t i = 0; i < kKeys; ++i) {
+        strings.push_back("tenant/" + std::to_string(i * 7919) + "/object/cache-entry");
+        shared.emplace_back(strings.back());
+    }
+    BenchStringKeys<std::string, std::unordered_map<std::string, int>>(
+        "std::string: copy 32 B key", "std::string: copy map layer (per key)",
+        "std::string: find", strings);
+    BenchStringKeys<SharedString,
+                    std::unordered_map<SharedString, int, SharedStringHash, std::equal_to<>>>(
+        "SharedString: copy 32 B key", "SharedString: copy map layer (per key)",
+        "SharedString: find (cached hash)", shared);
+}
+
+///================================================================================================///
+
+// Readers take snapshots of a config that a writer changes now and then.
+template <typename Value, typename Change>
+void BenchCopyOnWrite(const char* copy_name, const char* cow_name, const char* batch_name,
+                      const Value& initial, Change change) {
+    constexpr size_t kChanges = 1 << 8;
+    constexpr size_t kReaders = 16;
+    Value current = initial;
+    Measure(copy_name, kChanges * kReaders, [&] {
+        for (size_t i = 0; i < kChanges; ++i) {
+            std::vector<Value> snapshots(kReaders, current);
+            DoNotOptimize(snapshots.data());
+            change(current, i);
+        }
+    });
+    auto shared = CowPtr<Value>(MakeShared<Value>(initial));
+    Measure(cow_name, kChanges * kReaders, [&] {
+        for (size_t i = 0; i < kChanges; ++i) {
+            std::vector<SharedPtr<const Value>> snapshots(kReaders, shared.Snapshot());
+            DoNotOptimize(snapshots.data());
+            change(shared.Mutate(), i);
+        }
+    });
+    // No reader in between: one check per batch, no clones at all.
+    Measure(batch_name, kChanges * 64, [&] {
+        for (size_t i = 0; i < kChanges; ++i) {
+            shared.Update([&](Value& value) {
+                for (size_t j = 0; j < 64; ++j) {
+                    change(value, i * 64 + j);
+                }
+            });
+        }
+    });
+}
+
+void BenchCow() {
+    std::vector<int> vector(1 << 16, 1);
+    BenchCopyOnWrite("vector<int>(64K): deep copy (per snapshot)",
+                     "vector<int>(64K): CowPtr (per snapshot)",
+                     "vector<int>(64K): CowPtr batched write", vector,
+                     [](std::vector<int>& value, size_t i) { value[i % value.size()] += 1; });
+    std::map<int, int> map;
+    for (int i = 0; i < (1 << 12); ++i) {
+        map.emplace(i, i);
+    }
+    BenchCopyOnWrite("map<int, int>(4K): deep copy (per snapshot)",
+                     "map<int, int>(4K): CowPtr (per snapshot)",
+                     "map<int, int>(4K): CowPtr batched write", map, [](auto& value, size_t i) {
+                         value[static_cast<int>(i % 4096)]++;
+                     });
+}
+
+///================================================================================================///
+
+// Heap bytes in use, to measure what keeping a version alive costs.
+size_t HeapInUse() {
+    return mallinfo2().uordblks;
+}
+
+void BenchPersistent() {
+    constexpr size_t kKeys = 1 << 16;
+    constexpr size_t kVersions = 64;
+
+    // Snapshot per request: every request sees its own version of the map.
+    std::unordered_map<uint64_t, uint64_t> table;
+    PersistentHashMap<uint64_t, uint64_t> map;
+    {
+        auto transient = map.Transient();
+        for (uint64_t key = 0; key < kKeys; ++key) {
+            table.emplace(key, key);
+            transient.Set(key, key);
+        }
+        map = std::move(transient).Persistent();
+    }
+    std::vector<std::unordered_map<uint64_t, uint64_t>> table_versions;
+    size_t heap = HeapInUse();
+    Measure("std::unordered_map(64K): copy + update", kVersions, [&] {
+        for (uint64_t i = 0; i < kVersions; ++i) {
+            table_versions.push_back(table_versions.empty() ? table : table_versions.back());
+            table_versions.back()[i * 977 % kKeys] = i;
+        }
+    });
+    std::printf("%-48s %8zu B/version\n", "std::unordered_map(64K): memory",
+                (HeapInUse() - heap) / kVersions);
+    std::vector<PersistentHashMap<uint64_t, uint64_t>> map_versions;
+    heap = HeapInUse();
+    Measure("PersistentHashMap(64K): Set", kVersions, [&] {
+        for (uint64_t i = 0; i < kVersions; ++i) {
+            map_versions.push_back((map_versions.empty() ? map : map_versions.back())
+                                       .Set(i * 977 % kKeys, i));
+        }
+    });
+    std::printf("%-48s %8zu B/version\n", "PersistentHashMap(64K): memory",
+                (HeapInUse() - heap) / kVersions);
+    table_versions.clear();
+    map_versions.clear();
+
+    constexpr size_t kOperations = 1 << 18;
+    Measure("PersistentHashMap(64K): Set, many versions", kOperations, [&] {
+        auto version = map;
+        for (uint64_t i = 0; i < kOperations; ++i) {
+            version = version.Set(i * 977 % kKeys, i);
+        }
+        DoNotOptimize(version.Size());
+    });
+    Measure("PersistentHashMap(64K): Set, transient", kOperations, [&] {
+        auto transient = map.Transient();
+        for (uint64_t i = 0; i < kOperations; ++i) {
+            transient.Set(i * 977 % kKeys, i);
+        }
+        DoNotOptimize(transient.Size());
+    });
+    Measure("std::unordered_map(64K): find", kOperations, [&] {
+        uint64_t sum = 0;
+        for (uint64_t i = 0; i < kOperations; ++i) {
+            sum += table.find(i * 977 % kKeys)->second;
+        }
+        DoNotOptimize(sum);
+    });
+    Measure("PersistentHashMap(64K): Find", kOperations, [&] {
+        uint64_t sum = 0;
+        for (uint64_t i = 0; i < kOperations; ++i) {
+            sum += *map.Find(i * 977 % kKeys);
+        }
+        DoNotOptimize(sum);
+    });
+
+    PersistentVector<uint64_t> vector;
+    {
+        auto transient = vector.Transient();
+        for (uint64_t i = 0; i < kKeys; ++i) {
+            transient.PushBack(i);
+        }
+        vector = std::move(transient).Persistent();
+    }
+    Measure("PersistentVector(64K): Set, many versions", kOperations, [&] {
+        auto version = vector;
+        for (uint64_t i = 0; i < kOperations; ++i) {
+            version = version.Set(i * 977 % kKeys, i);
+        }
+        DoNotOptimize(version.Size());
+    });
+    Measure("PersistentVector: PushBack, transient", kOperations, [&] {
+        auto transient = PersistentVector<uint64_t>().Transient();
+        for (uint64_t i = 0; i < kOperations; ++i) {
+            transient.PushBack(i);
+        }
+        DoNotOptimize(transient.Size());
+    });
+    Measure("PersistentVector(64K): operator[]", kOperations, [&] {
+        uint64_t sum = 0;
+        for (uint64_t i = 0; i < kOperations; ++i) {
+            sum += vector[i * 977 % kKeys];
+        }
+        DoNotOptimize(sum);
+    });
+}
+
+///================================================================================================///
+
+int main() {
+    BenchBatch();
+    BenchOwnerMap();
+    BenchSharedFromThis();
+    BenchCasts();
+    BenchIntrusive();
+    BenchCounterPolicies();
+    BenchPool();
+    BenchUniquePromotion();
+    BenchInterop();
+    BenchStdInterop();
+    BenchTeardown();
+    BenchCycles();
+    BenchSlotMap();
+    BenchTagged();
+    BenchOffset();
+    BenchShm();
+    BenchMappedFile();
+    BenchSharedBuffer();
+    BenchTrailing();
+    BenchSharedString();
+    BenchCow();
+    BenchPersistent();
+    return 0;
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+#include "sw_fwd.h"  // Forward declaration
+#include "intrusive.h"
+#include "shared.h"
+#include "weak.h"
+
+#include <cassert>
+#include <cstddef>  // std::nullptr_t
+#include <cstdint>
+#include <type_traits>
+
+// Non-owning view of an object whose lifetime is guaranteed by some owner up the call stack.
+// Passed by value instead of `const SharedPtr<T>&`: copying it never touches a counter, and the
+// callee reads the object pointer without going through the owner first.
+//
+// A borrow taken from a `SharedPtr` remembers its owner, so it can be turned back into an owner
+// with `Promote()`. Borrowing never allocates: while the owner was never shared, the borrow refers
+// to the owner itself, and `Promote()` gives it its control block then. Such a borrow needs that
+// `SharedPtr` to stay in place and keep the object until the borrow is gone.
+//
+// In debug builds live borrows are counted per control block (or per owner, for owners that were
+// never shared). Losing the last strong reference while one is alive, or resetting or moving away
+// an owner that borrows still refer to, trips an assertion in `SharedPtr`.
+inline namespace BORROW_ABI_NAMESPACE {
+
+template <typename T>
+class BorrowPtr {
+    template <typename Y>
+    friend class BorrowPtr;
+
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    BorrowPtr() {
+        ptr_ = nullptr;
+        owner_ = 0;
+    }
+    BorrowPtr(std::nullptr_t) {
+        ptr_ = nullptr;
+        owner_ = 0;
+    }
+
+    // Also accepts temporaries such as `weak.Lock()` passed straight to a `BorrowPtr` parameter:
+    // they live until the end of the full expression, exactly as long as the parameter. Anywhere
+    // else the temporary dies first: `BorrowPtr<T> b = weak.Lock();` dangles at once.
+    template <typename Y>
+    BorrowPtr(const SharedPtr<Y>& owner) : ptr_(owner.ptr_), owner_(OwnerOf(owner)) {
+        static_assert(std::is_convertible_v<Y*, T*>, "Inconvertible types");
+        Track();
+    }
+
+    template <typename Y>
+    BorrowPtr(const IntrusivePtr<Y>& owner) : ptr_(owner.Get()), owner_(0) {
+        static_assert(std::is_convertible_v<Y*, T*>, "Inconvertible types");
+    }
+
+    template <typename Y>
+    BorrowPtr(const BorrowPtr<Y>& other) : ptr_(other.ptr_), owner_(other.template Converted<T>()) {
+        static_assert(std::is_convertible_v<Y*, T*>, "Inconvertible types");
+        Track();
+    }
+
+#ifdef NDEBUG
+    BorrowPtr(const BorrowPtr& other) = default;
+    BorrowPtr& operator=(const BorrowPtr& other) = default;
+    ~BorrowPtr() = default;
+#else
+    BorrowPtr(const BorrowPtr& other) : ptr_(other.ptr_), owner_(other.owner_) {
+        Track();
+    }
+    BorrowPtr& operator=(const BorrowPtr& other) {
+        Untrack();
+        ptr_ = other.ptr_;
+        owner_ = other.owner_;
+        Track();
+        return *this;
+    }
+    ~BorrowPtr() {
+        Untrack();
+    }
+#endif
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    T* Get() const {
+        return ptr_;
+    }
+    T& operator*() const {
+        return *ptr_;
+    }
+    T* operator->() const {
+        return Get();
+    }
+    explicit operator bool() const {
+        return Get() != nullptr;
+    }
+
+    // Take shared ownership through the control block of the `SharedPtr` this was borrowed from.
+    // Borrows of intrusive objects have no control block and promote to an empty pointer; wrap
+    // `Get()` in an `IntrusivePtr` instead.
+    SharedPtr<T> Promote() const {
+        SharedPtr<T> owner;
+        if (owner_ != 0) {
+            ControlBlockBase* cb = Block();
+            assert(cb->strong_counter_ > 0 && "BorrowPtr outlived the last SharedPtr");
+            cb->strong_counter_++;
+            owner.ptr_ = ptr_;
+            owner.cb_ = cb;
+        }
+        return owner;
+    }
+
+private:
+    // Marks `owner_` as the address of a never-shared owner's `cb_` rather than a control block.
+    static constexpr uintptr_t kSlot = 1;
+
+    // The deferred block deletes the object through the owner's own pointer, which `Promote()`
+    // passes on from `ptr_`. A conversion that moves the pointer allocates the block right away.
+    template <typename U, typename Y>
+    static bool SameAddress(Y* ptr) {
+        return static_cast<const volatile void*>(static_cast<U*>(ptr)) ==
+               static_cast<const volatile void*>(ptr);
+    }
+
+    template <typename Y>
+    static uintptr_t OwnerOf(const SharedPtr<Y>& owner) {
+        if (!SharedPtr<Y>::Deferred(owner.cb_)) {
+            return reinterpret_cast<uintptr_t>(owner.cb_);
+        }
+        if (!SameAddress<T>(owner.ptr_)) {
+            return reinterpret_cast<uintptr_t>(SharedPtr<Y>::ShareBlock(owner));
+        }
+        return reinterpret_cast<uintptr_t>(&owner.cb_) | kSlot;
+    }
+    template <typename U>
+    uintptr_t Converted() const {
+        if ((owner_ & kSlot) != 0 && !SameAddress<U>(ptr_)) {
+            return reinterpret_cast<uintptr_t>(Block());
+        }
+        return owner_;
+    }
+
+    // The owner's control block, allocated in place if the owner was never shared.
+    ControlBlockBase* Block() const {
+        if ((owner_ & kSlot) == 0) {
+            return reinterpret_cast<ControlBlockBase*>(owner_);
+        }
+        auto& cb = *reinterpret_cast<ControlBlockBase**>(owner_ & ~kSlot);
+        assert(cb != nullptr && "SharedPtr moved away while borrowed");
+        return SharedPtr<T>::Materialize(cb, const_cast<std::remove_cv_t<T>*>(ptr_));
+    }
+
+    void Track() {
+#ifndef NDEBUG
+        if (owner_ != 0) {
+            BorrowCounts::Add(reinterpret_cast<const void*>(owner_ & ~kSlot));
+        }
+#endif
+    }
+    void Untrack() {
+#ifndef NDEBUG
+        if (owner_ != 0) {
+            BorrowCounts::Remove(reinterpret_cast<const void*>(owner_ & ~kSlot));
+        }
+#endif
+    }
+
+    T* ptr_;
+    // The owner's control block or, for an owner that was never shared, the address of its `cb_`
+    // tagged with `kSlot`.
+    uintptr_t owner_;
+};
+
+template <typename T, typename U>
+inline bool operator==(const BorrowPtr<T>& left, const BorrowPtr<U>& right) {
+    return left.Get() == right.Get();
+}
+
+}  // namespace BORROW_ABI_NAMESPACE
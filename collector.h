@@ -0,0 +1,405 @@
+#pragma once
+
+#include "sw_fwd.h"  // Forward declaration
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+// Cycle collection for `SharedPtr` graphs, after Bacon and Rajan, "Concurrent Cycle Collection in
+// Reference Counted Systems" (synchronous variant). Types opt in by deriving from `Collectable`
+// and listing their `SharedPtr` members in `Trace`. Whenever such an object loses a reference but
+// stays alive it becomes a candidate root of a garbage cycle. `CollectCycles` runs trial deletion
+// from the candidates: it subtracts the references that come from inside the traced subgraph,
+// and whatever is left without outside references is garbage and gets destroyed.
+//
+// Counters are not atomic, so collection is synchronous and per thread. Pauses are bounded by
+// the tracing budget of a call, see `CollectCycles(max_roots, max_traced)`: trial deletion gives
+// up on a candidate whose subgraph needs more than the budget, restores the counts and retries
+// it later. A cycle larger than the budget waits for a call with a larger one.
+
+class CycleTracer;
+
+class Collectable {
+public:
+    // Calls `tracer(member)` for every `SharedPtr` member that may point to a `Collectable`.
+    virtual void Trace(CycleTracer& tracer) const = 0;
+
+protected:
+    Collectable() = default;
+    // Copies of an object are separate nodes of the graph.
+    Collectable(const Collectable&) {
+    }
+    Collectable& operator=(const Collectable&) {
+        return *this;
+    }
+    virtual ~Collectable() = default;
+
+private:
+    enum class Color : uint8_t {
+        kBlack,   // In use
+        kGray,    // Possible member of a cycle
+        kWhite,   // Member of a garbage cycle
+        kPurple,  // Possible root of a cycle
+    };
+
+    size_t& Count() const {
+        return block_->strong_counter_;
+    }
+
+    // Set by `SharedPtr` when the object gets its owner.
+    ControlBlockBase* block_ = nullptr;
+    Color color_ = Color::kBlack;
+    bool buffered_ = false;
+
+    friend class CycleCollector;
+    friend class CycleTracer;
+    template <typename Y>
+    friend class SharedPtr;
+};
+
+class CycleTracer {
+public:
+    // A member that aliases another owner holds a reference to that owner's block rather than to
+    // the object's own, so it is not an edge to the object. Leaving it out can keep a cycle
+    // through it alive, but never frees an object that is still referenced.
+    template <typename Y>
+    void operator()(const SharedPtr<Y>& ptr) {
+        if constexpr (std::is_base_of_v<Collectable, Y>) {
+            auto* child = const_cast<Collectable*>(static_cast<const Collectable*>(ptr.Get()));
+            if (child != nullptr && child->block_ != nullptr && child->block_ == ptr.cb_) {
+                children_.push_back(child);
+            }
+        }
+    }
+
+private:
+    std::vector<Collectable*> children_;
+
+    friend class CycleCollector;
+};
+
+struct CycleCollectorStats {
+    size_t collections = 0;      // Calls to `CollectCycles`
+    size_t roots_buffered = 0;   // Objects that became candidate roots
+    size_t roots_examined = 0;   // Candidates taken out of the buffer by collections
+    size_t objects_traced = 0;   // `Trace` calls
+    size_t objects_freed = 0;    // Members of garbage cycles destroyed
+};
+
+// One per thread, see `ThreadCycleCollector()`.
+class CycleCollector {
+    using Color = Collectable::Color;
+
+public:
+    CycleCollector(const CycleCollector&) = delete;
+    CycleCollector& operator=(const CycleCollector&) = delete;
+    // Buffered candidates hold weak references to their blocks. When the thread exits, a last
+    // collection frees the garbage among them and gives those references back.
+    ~CycleCollector() {
+        while (!roots_.empty()) {
+            Collect(roots_.size());
+        }
+        destroyed_ = true;
+    }
+
+    // Whether this thread's collector is gone. Owners in thread-local or static objects destroyed
+    // after it release their references without offering candidates: a cycle that loses its last
+    // outside reference that late is not collected.
+    static bool Destroyed() {
+        return destroyed_;
+    }
+
+    // Called by `SharedPtr` after `object`, owned through `block`, lost a reference and is still
+    // alive.
+    void PossibleRoot(ControlBlockBase* block, Collectable* object) {
+        if (destroying_ || object->block_ != block || object->color_ == Color::kPurple) {
+            return;
+        }
+        object->color_ = Color::kPurple;
+        if (!object->buffered_) {
+            object->buffered_ = true;
+            // The weak reference keeps the block readable if the object dies before collection.
+            object->block_->weak_counter_++;
+            roots_.push_back({object->block_, object});
+            ++stats_.roots_buffered;
+        }
+    }
+
+    // Examines up to `max_roots` candidates, oldest first, and destroys the garbage cycles found
+    // through them. Marking traces at most `max_traced` objects, and the later phases only visit
+    // what it marked, so a call traces a small multiple of the budget. Candidates left over when
+    // the budget runs out stay buffered. Returns the number of objects destroyed.
+    size_t Collect(size_t max_roots, size_t max_traced = std::numeric_limits<size_t>::max()) {
+        if (destroying_ || roots_.empty()) {
+            return 0;
+        }
+        ++stats_.collections;
+        size_t taken = std::min(max_roots, roots_.size());
+        std::vector<Root> batch(roots_.begin(), roots_.begin() + taken);
+        roots_.erase(roots_.begin(), roots_.begin() + taken);
+
+        std::vector<Root> retry;
+        size_t marked = MarkRoots(batch, max_traced);
+        if (marked < taken) {
+            retry = TakeUnmarked(batch, marked);
+        }
+        stats_.roots_examined += batch.size();
+        for (const Root& root : batch) {
+            if (root.object != nullptr) {
+                Scan(root.object);
+            }
+        }
+        std::vector<Collectable*> garbage;
+        for (const Root& root : batch) {
+            if (root.object != nullptr) {
+                root.object->buffered_ = false;
+                CollectWhite(root.object, garbage);
+            }
+        }
+        Destroy(garbage);
+        for (const Root& root : batch) {
+            DropWeak(root.block);
+        }
+        Requeue(retry);
+        return garbage.size();
+    }
+
+    size_t PendingRoots() const {
+        return roots_.size();
+    }
+
+    const CycleCollectorStats& Stats() const {
+        return stats_;
+    }
+
+private:
+    struct Root {
+        ControlBlockBase* block;
+        Collectable* object;  // Reset when the candidate turned out to be dead or in use
+    };
+
+    // Valid until the next call.
+    const std::vector<Collectable*>& Children(Collectable* object) {
+        ++stats_.objects_traced;
+        tracer_.children_.clear();
+        object->Trace(tracer_);
+        return tracer_.children_;
+    }
+
+    // Subtracts references from inside the subgraph below every live purple candidate, within
+    // the budget. Returns the index of the candidate it stopped at.
+    size_t MarkRoots(std::vector<Root>& batch, size_t budget) {
+        size_t traced = 0;
+        for (size_t i = 0; i < batch.size(); ++i) {
+            Root& root = batch[i];
+            if (root.block->strong_counter_ != 0 && root.object->color_ == Color::kPurple) {
+                if (!MarkGray(root.object, budget, traced)) {
+                    return i;
+                }
+            } else {
+                if (root.block->strong_counter_ != 0) {
+                    root.object->buffered_ = false;
+                }
+                root.object = nullptr;
+            }
+        }
+        return batch.size();
+    }
+
+    // Gives up, with the counts restored, once `traced` reaches `budget`.
+    bool MarkGray(Collectable* start, size_t budget, size_t& traced) {
+        start->color_ = Color::kGray;
+        stack_.push_back(start);
+        while (!stack_.empty()) {
+            if (traced == budget) {
+                Abandon(start);
+                return false;
+            }
+            ++traced;
+            Collectable* object = stack_.back();
+            stack_.pop_back();
+            for (Collectable* child : Children(object)) {
+                child->Count()--;
+                if (child->color_ != Color::kGray) {
+                    child->color_ = Color::kGray;
+                    stack_.push_back(child);
+                }
+            }
+        }
+        return true;
+    }
+
+    // Objects still on the stack were never traced and took nothing from their children. The
+    // gray ones that were give their references back, which may reach into the subgraphs of
+    // candidates marked earlier in the batch.
+    void Abandon(Collectable* start) {
+        for (Collectable* object : stack_) {
+            object->color_ = Color::kBlack;
+        }
+        stack_.clear();
+        if (start->color_ == Color::kGray) {
+            ScanBlack(start);
+        }
+    }
+
+    // Removes from the batch the candidates that go back to the buffer: those before `marked`
+    // that `Abandon` turned black again, those after it, and last the one marking gave up on.
+    std::vector<Root> TakeUnmarked(std::vector<Root>& batch, size_t marked) {
+        std::vector<Root> retry;
+        std::vector<Root> kept;
+        for (size_t i = 0; i < batch.size(); ++i) {
+            Root& root = batch[i];
+            if (i == marked) {
+                continue;
+            }
+            if (i > marked || (root.object != nullptr && root.object->color_ != Color::kGray)) {
+                retry.push_back(root);
+            } else {
+                kept.push_back(root);
+            }
+        }
+        retry.push_back(batch[marked]);
+        batch = std::move(kept);
+        return retry;
+    }
+
+    // Buffers the candidates again, keeping their weak references. The one that did not fit the
+    // budget goes to the back, so that it does not hold back the others. Any of them may have
+    // turned out to be garbage meanwhile, and the next collection finds it dead.
+    void Requeue(std::vector<Root>& retry) {
+        if (retry.empty()) {
+            return;
+        }
+        for (Root& root : retry) {
+            if (root.object != nullptr && root.block->strong_counter_ != 0) {
+                root.object->color_ = Color::kPurple;
+            }
+        }
+        roots_.push_back(retry.back());
+        roots_.insert(roots_.begin(), retry.begin(), retry.end() - 1);
+    }
+
+    // Gray objects still referenced from outside are restored, the rest turn white.
+    void Scan(Collectable* start) {
+        stack_.push_back(start);
+        while (!stack_.empty()) {
+            Collectable* object = stack_.back();
+            stack_.pop_back();
+            if (object->color_ != Color::kGray) {
+                continue;
+            }
+            if (object->Count() != 0) {
+                ScanBlack(object);
+                continue;
+            }
+            object->color_ = Color::kWhite;
+            for (Collectable* child : Children(object)) {
+                stack_.push_back(child);
+            }
+        }
+    }
+
+    // Uses its own stack: it runs in the middle of `Scan`.
+    void ScanBlack(Collectable* start) {
+        start->color_ = Color::kBlack;
+        std::vector<Collectable*> stack{start};
+        while (!stack.empty()) {
+            Collectable* object = stack.back();
+            stack.pop_back();
+            for (Collectable* child : Children(object)) {
+                child->Count()++;
+                if (child->color_ != Color::kBlack) {
+                    child->color_ = Color::kBlack;
+                    stack.push_back(child);
+                }
+            }
+        }
+    }
+
+    // Garbage may include candidates that are still buffered for a later collection: their
+    // entries hold a weak reference, and that collection finds them dead.
+    void CollectWhite(Collectable* start, std::vector<Collectable*>& garbage) {
+        stack_.push_back(start);
+        while (!stack_.empty()) {
+            Collectable* object = stack_.back();
+            stack_.pop_back();
+            if (object->color_ != Color::kWhite) {
+                continue;
+            }
+            object->color_ = Color::kBlack;
+            garbage.push_back(object);
+            for (Collectable* child : Children(object)) {
+                stack_.push_back(child);
+            }
+        }
+    }
+
+    // Trial deletion left the references held by garbage subtracted. They are put back, so that
+    // destroying the objects releases their members as usual, and one more reference keeps each
+    // object from being destroyed a second time by the others.
+    void Destroy(const std::vector<Collectable*>& garbage) {
+        std::vector<ControlBlockBase*> blocks;
+        blocks.reserve(garbage.size());
+        for (Collectable* object : garbage) {
+            for (Collectable* child : Children(object)) {
+                child->Count()++;
+            }
+        }
+        for (Collectable* object : garbage) {
+            object->Count()++;
+            object->block_->weak_counter_++;
+            blocks.push_back(object->block_);
+        }
+        destroying_ = true;
+        for (ControlBlockBase* block : blocks) {
+            block->DeleteData();
+        }
+        destroying_ = false;
+        for (ControlBlockBase* block : blocks) {
+            block->strong_counter_ = 0;
+            DropWeak(block);
+        }
+        stats_.objects_freed += garbage.size();
+    }
+
+    static void DropWeak(ControlBlockBase* block) {
+        if (--block->weak_counter_ == 0 && block->strong_counter_ == 0) {
+            block->DeleteBlock();
+        }
+    }
+
+    CycleCollector() = default;
+    friend CycleCollector& ThreadCycleCollector();
+
+    std::vector<Root> roots_;
+    std::vector<Collectable*> stack_;
+    CycleTracer tracer_;
+    bool destroying_ = false;
+    CycleCollectorStats stats_;
+    // Trivially destructible, so it can still be read once the thread's collector is destroyed.
+    static inline thread_local bool destroyed_ = false;
+};
+
+inline CycleCollector& ThreadCycleCollector() {
+    thread_local CycleCollector collector;
+    return collector;
+}
+
+// Examines up to `max_roots` candidate roots on this thread, tracing at most about `max_traced`
+// objects while marking, and destroys the garbage cycles found. Returns the number of objects
+// destroyed.
+inline size_t CollectCycles(size_t max_roots = std::numeric_limits<size_t>::max(),
+                            size_t max_traced = std::numeric_limits<size_t>::max()) {
+    if (CycleCollector::Destroyed()) {
+        return 0;
+    }
+    return ThreadCycleCollector().Collect(max_roots, max_traced);
+}
+
+inline const CycleCollectorStats& CycleStats() {
+    return ThreadCycleCollector().Stats();
+}
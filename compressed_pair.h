@@ -1,56 +1,72 @@
 #pragma once
 
-#include <exception>
-#include <memory>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
 
-class ControlBlockBase {
-public:
-    size_t strong_counter_;
-    size_t weak_counter_;
-    virtual void DeleteData() = 0;
-    virtual ~ControlBlockBase() = default;
-};
+// Pair that takes no space for empty members: an empty, non-final type is stored as a base class
+// so the empty base optimization folds it away. `UniquePtr` uses it to keep a stateless deleter
+// from growing the pointer.
 
-template <typename T>
-class ControlBlockWithObject : public ControlBlockBase {
+template <typename T, size_t Index, bool = std::is_empty_v<T> && !std::is_final_v<T>>
+class CompressedElement {
 public:
-    alignas(T) unsigned char buf_[sizeof(T)];
-
-    template <typename... Args>
-    ControlBlockWithObject(Args&&... args) {
-        strong_counter_ = 1;
-        weak_counter_ = 0;
-        ptr_ = new (&buf_) T(std::forward<Args>(args)...);
+    CompressedElement() = default;
+    template <typename U>
+    CompressedElement(U&& value) : value_(std::forward<U>(value)) {
     }
 
-    T* ptr_;
-
-    void DeleteData() override {
-        reinterpret_cast<T*>(&buf_)->~T();
+    T& Get() {
+        return value_;
     }
+    const T& Get() const {
+        return value_;
+    }
+
+private:
+    T value_{};
 };
 
-template <typename T>
-class ControlBlockWithPointer : public ControlBlockBase {
+template <typename T, size_t Index>
+class CompressedElement<T, Index, true> : private T {
 public:
-    ControlBlockWithPointer(T* ptr) : ptr_(ptr) {
-        strong_counter_ = 1;
-        weak_counter_ = 0;
+    CompressedElement() = default;
+    template <typename U>
+    CompressedElement(U&& value) : T(std::forward<U>(value)) {
     }
 
-    T* ptr_;
-
-    void DeleteData() override {
-        delete ptr_;
+    T& Get() {
+        return *this;
+    }
+    const T& Get() const {
+        return *this;
     }
 };
 
-struct NeedNewObject {};
+// The index keeps the bases distinct when both members have the same empty type.
+template <typename F, typename S>
+class CompressedPair : private CompressedElement<F, 0>, private CompressedElement<S, 1> {
+    using First = CompressedElement<F, 0>;
+    using Second = CompressedElement<S, 1>;
 
-class BadWeakPtr : public std::exception {};
+public:
+    CompressedPair() = default;
+    template <typename U, typename V>
+    CompressedPair(U&& first, V&& second)
+        : First(std::forward<U>(first)), Second(std::forward<V>(second)) {
+    }
 
-template <typename T>
-class SharedPtr;
+    F& GetFirst() {
+        return First::Get();
+    }
+    const F& GetFirst() const {
+        return First::Get();
+    }
 
-template <typename T>
-class WeakPtr;
+    S& GetSecond() {
+        return Second::Get();
+    }
+    const S& GetSecond() const {
+        return Second::Get();
+    }
+};
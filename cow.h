@@ -0,0 +1,92 @@
+#pragma once
+
+#include "sw_fwd.h"  // Forward declaration
+#include "shared.h"
+
+#include <cassert>
+#include <cstddef>  // std::nullptr_t
+#include <utility>
+
+// Copy-on-write value: copies and `Snapshot()`s share one immutable `T`, and `Mutate()` clones it
+// only when someone else can still see it. That is the case while another owner exists, and also
+// while a `WeakPtr` observes it: a weak observer that locks later must not find the value changed
+// under it.
+//
+// The reference returned by `Mutate()` stays writable only until the next copy or snapshot.
+// `Update()` scopes a batch of changes to one check and one clone at most.
+
+template <typename T>
+class CowPtr {
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    CowPtr() = default;
+    CowPtr(std::nullptr_t) {
+    }
+    explicit CowPtr(SharedPtr<T> ptr) : ptr_(std::move(ptr)) {
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    // Writable access, cloning the value first if it is shared.
+    T& Mutate() {
+        assert(ptr_ && "Mutating an empty CowPtr");
+        if (!IsUnique()) {
+            ptr_ = MakeShared<T>(std::as_const(*ptr_));
+        }
+        return *ptr_;
+    }
+
+    // Runs `update` on the writable value: a batch of changes pays for one check and one clone
+    // at most.
+    template <typename F>
+    decltype(auto) Update(F&& update) {
+        return std::forward<F>(update)(Mutate());
+    }
+
+    void Reset() {
+        ptr_.Reset();
+    }
+    void Swap(CowPtr& other) {
+        ptr_.Swap(other.ptr_);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    const T* Get() const {
+        return ptr_.Get();
+    }
+    const T& operator*() const {
+        return *ptr_;
+    }
+    const T* operator->() const {
+        return ptr_.Get();
+    }
+    explicit operator bool() const {
+        return static_cast<bool>(ptr_);
+    }
+
+    // Read-only owner of the current value, e.g. to hand to readers that outlive this pointer.
+    SharedPtr<const T> Snapshot() const {
+        return ptr_;
+    }
+
+    size_t UseCount() const {
+        return ptr_.UseCount();
+    }
+    // Nothing else owns or observes the value, so `Mutate()` writes in place.
+    bool IsUnique() const {
+        return ptr_.UseCount() == 1 && !ptr_.Observed();
+    }
+
+private:
+    SharedPtr<T> ptr_;
+};
+
+template <typename T, typename... Args>
+CowPtr<T> MakeCow(Args&&... args) {
+    return CowPtr<T>(MakeShared<T>(std::forward<Args>(args)...));
+}
@@ -1,12 +1,26 @@
 #pragma once
 
+#include "sw_fwd.h"  // Forward declaration
+#include "teardown.h"
+
+#include <atomic>
+#include <cassert>
 #include <cstddef>  // for std::nullptr_t
+#include <cstdint>
+#include <limits>
 #include <utility>  // for std::exchange / std::swap
 #include <memory>
+#include <type_traits>
 
-class SimpleCounter {
+// Single-threaded counter. The narrow variants let the counter share a word with small fields
+// of the derived object instead of taking a whole `size_t` of its own.
+template <typename Count>
+class BasicCounter {
 public:
+    static constexpr bool kThreadSafe = false;
+
     size_t IncRef() {
+        assert(count_ != std::numeric_limits<Count>::max() && "Reference counter overflow");
         return ++count_;
     }
     size_t DecRef() {
@@ -17,9 +31,47 @@ public:
     }
 
 private:
-    size_t count_ = 0;
+    Count count_ = 0;
 };
 
+using SimpleCounter = BasicCounter<size_t>;
+using SimpleCounter32 = BasicCounter<uint32_t>;
+using SimpleCounter16 = BasicCounter<uint16_t>;
+
+// Counter that may be shared between threads. New references are always made from an existing
+// one, so the increment needs no ordering. The decrement releases this thread's writes to the
+// object, and whoever drops the last reference acquires all of them before destroying it.
+template <typename Count>
+class BasicAtomicCounter {
+public:
+    static constexpr bool kThreadSafe = true;
+
+    size_t IncRef() {
+        return count_.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+    size_t DecRef() {
+#if defined(__SANITIZE_THREAD__)
+        // ThreadSanitizer does not model fences; give it the equivalent ordering on the RMW itself.
+        return count_.fetch_sub(1, std::memory_order_acq_rel) - 1;
+#else
+        Count previous = count_.fetch_sub(1, std::memory_order_release);
+        if (previous == 1) {
+            std::atomic_thread_fence(std::memory_order_acquire);
+        }
+        return previous - 1;
+#endif
+    }
+    size_t RefCount() const {
+        return count_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<Count> count_ = 0;
+};
+
+using AtomicCounter = BasicAtomicCounter<size_t>;
+using AtomicCounter32 = BasicAtomicCounter<uint32_t>;
+
 struct DefaultDelete {
     template <typename T>
     static void Destroy(T* object) {
@@ -30,6 +82,14 @@ struct DefaultDelete {
 template <typename Derived, typename Counter, typename Deleter>
 class RefCounted {
 public:
+    RefCounted() = default;
+    // A copy of an object is a new object: it starts without references.
+    RefCounted(const RefCounted&) {
+    }
+    RefCounted& operator=(const RefCounted&) {
+        return *this;
+    }
+
     // Increase reference counter.
     void IncRef() {
         counter_.IncRef();
@@ -38,8 +98,14 @@ public:
     // Decrease reference counter.
     // Destroy object using Deleter when the last instance dies.
     void DecRef() {
-        if (counter_.RefCount() > 0 && counter_.DecRef() == 0) {
-            Deleter::Destroy(static_cast<Derived*>(this));
+        if (counter_.DecRef() == 0) {
+            if constexpr (std::is_base_of_v<IterativeTeardown, Derived>) {
+                PostponeTeardown(static_cast<Derived*>(this), [](void* object) {
+                    Deleter::Destroy(static_cast<Derived*>(object));
+                });
+            } else {
+                Deleter::Destroy(static_cast<Derived*>(this));
+            }
         }
     }
 
@@ -55,6 +121,15 @@ private:
 template <typename Derived, typename D = DefaultDelete>
 using SimpleRefCounted = RefCounted<Derived, SimpleCounter, D>;
 
+template <typename Derived, typename D = DefaultDelete>
+using ThreadSafeRefCounted = RefCounted<Derived, AtomicCounter, D>;
+
+// Construction tags for `IntrusivePtr` from a raw pointer.
+// `AdoptRef` takes over a reference the caller already holds (e.g. one returned by a C API),
+// `RetainRef` adds a new one, which is also what the untagged constructor does.
+struct AdoptRef {};
+struct RetainRef {};
+
 template <typename T>
 class IntrusivePtr {
     template <typename Y>
@@ -68,18 +143,21 @@ public:
     IntrusivePtr(std::nullptr_t) {
         ptr_ = nullptr;
     }
-    IntrusivePtr(T* ptr) {
+    IntrusivePtr(T* ptr) : IntrusivePtr(ptr, RetainRef{}) {
+    }
+    IntrusivePtr(T* ptr, RetainRef) {
         ptr_ = ptr;
         if (ptr_) {
             ptr_->IncRef();
         }
     }
+    IntrusivePtr(T* ptr, AdoptRef) {
+        ptr_ = ptr;
+    }
 
     template <typename Y>
     IntrusivePtr(const IntrusivePtr<Y>& other) {
-        if (other.ptr_ != nullptr && other.UseCount() == 0) {
-            other->IncRef();
-        }
+        static_assert(std::is_convertible_v<Y*, T*>, "Inconvertible types");
         ptr_ = other.ptr_;
         if (ptr_) {
             ptr_->IncRef();
@@ -88,55 +166,58 @@ public:
 
     template <typename Y>
     IntrusivePtr(IntrusivePtr<Y>&& other) {
-        if (other.ptr_ != nullptr && other.UseCount() == 0) {
-            other->IncRef();
-        }
-        ptr_ = std::move(other.ptr_);
-        other.ptr_ = nullptr;
+        static_assert(std::is_convertible_v<Y*, T*>, "Inconvertible types");
+        ptr_ = std::exchange(other.ptr_, nullptr);
     }
 
     IntrusivePtr(const IntrusivePtr& other) {
-        if (other.ptr_ != nullptr && other.UseCount() == 0) {
-            other->IncRef();
-        }
         ptr_ = other.ptr_;
         if (ptr_) {
             ptr_->IncRef();
         }
     }
     IntrusivePtr(IntrusivePtr&& other) {
-        if (other.ptr_ != nullptr && other.UseCount() == 0) {
-            other->IncRef();
+        ptr_ = std::exchange(other.ptr_, nullptr);
+    }
+
+    // Objects that are their own control block (`SharedRefCounted`) count `SharedPtr` and
+    // `IntrusivePtr` owners together, so either kind can be made from the other.
+    template <typename Y>
+    IntrusivePtr(const SharedPtr<Y>& other) {
+        static_assert(std::is_convertible_v<Y*, ControlBlockBase*>,
+                      "Needs an object with an embedded control block");
+        assert((other.Get() == nullptr || other.cb_ == other.Get()) && "Aliased SharedPtr");
+        ptr_ = other.Get();
+        if (ptr_) {
+            ptr_->IncRef();
         }
-        ptr_ = std::move(other.ptr_);
-        other.ptr_ = nullptr;
+    }
+    template <typename Y>
+    IntrusivePtr(SharedPtr<Y>&& other) {
+        static_assert(std::is_convertible_v<Y*, ControlBlockBase*>,
+                      "Needs an object with an embedded control block");
+        assert((other.Get() == nullptr || other.cb_ == other.Get()) && "Aliased SharedPtr");
+        ptr_ = std::exchange(other.ptr_, nullptr);
+        other.cb_ = nullptr;
     }
 
     // `operator=`-s
+    // The new reference is taken before the old one is dropped, which also covers self-assignment.
     IntrusivePtr& operator=(const IntrusivePtr& other) {
-        if (other.ptr_ != nullptr && other.UseCount() == 0) {
-            other->IncRef();
-        }
-        if (this == &other) {
-            return *this;
-        }
-        Reset();
-        ptr_ = other.ptr_;
+        T* old = std::exchange(ptr_, other.ptr_);
         if (ptr_) {
             ptr_->IncRef();
         }
+        if (old) {
+            old->DecRef();
+        }
         return *this;
     }
     IntrusivePtr& operator=(IntrusivePtr&& other) {
-        if (other.ptr_ != nullptr && other.UseCount() == 0) {
-            other->IncRef();
-        }
-        if (this == &other) {
-            return *this;
+        T* old = std::exchange(ptr_, std::exchange(other.ptr_, nullptr));
+        if (old) {
+            old->DecRef();
         }
-        Reset();
-        ptr_ = std::move(other.ptr_);
-        other.ptr_ = nullptr;
         return *this;
     }
 
@@ -147,31 +228,32 @@ public:
 
     // Modifiers
     void Reset() {
-        if (ptr_ != nullptr && UseCount() == 0) {
-            ptr_->IncRef();
-        }
-        if (ptr_) {
-            ptr_->DecRef();
-            ptr_ = nullptr;
+        if (T* old = std::exchange(ptr_, nullptr)) {
+            old->DecRef();
         }
     }
     void Reset(T* ptr) {
-        if (ptr_ != nullptr && UseCount() == 0) {
-            ptr_->IncRef();
-        }
-        if (ptr_ == ptr) {
-            return;
+        if (ptr) {
+            ptr->IncRef();
         }
-        Reset();
-        ptr_ = ptr;
-        if (ptr_) {
-            ptr_->IncRef();
+        if (T* old = std::exchange(ptr_, ptr)) {
+            old->DecRef();
         }
     }
     void Swap(IntrusivePtr& other) {
         std::swap(ptr_, other.ptr_);
     }
 
+    // Give up ownership without touching the counter. The caller becomes responsible for the
+    // reference, e.g. to hand it to a C API and take it back later with `AdoptRef`.
+    [[nodiscard]] T* Detach() {
+        return std::exchange(ptr_, nullptr);
+    }
+    // Same as `Detach()`, named after `std::unique_ptr::release`.
+    [[nodiscard]] T* Release() {
+        return Detach();
+    }
+
     // Observers
     T* Get() const {
         return ptr_;
@@ -192,10 +274,11 @@ public:
         return ptr_ != nullptr;
     }
 
+private:
     T* ptr_;
 };
 
 template <typename T, typename... Args>
 IntrusivePtr<T> MakeIntrusive(Args&&... args) {
     return IntrusivePtr<T>(new T(std::forward<Args>(args)...));
-}
\ No newline at end of file
+}
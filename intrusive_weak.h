@@ -0,0 +1,289 @@
+#pragma once
+
+#include "intrusive.h"
+
+#include <atomic>
+#include <cstddef>  // for std::nullptr_t
+#include <cstdint>
+#include <type_traits>
+#include <utility>  // for std::exchange / std::swap
+
+// Side table of an object that has been weakly observed. Once it exists it holds the strong
+// count as well, so that `Lock()` can test it after the object is gone.
+struct WeakRefBlock {
+    std::atomic<size_t> strong;
+    // Observers, plus one held on behalf of the object while it is alive.
+    std::atomic<size_t> weak;
+};
+
+// Reference-counted base that supports `IntrusiveWeakPtr`. The object keeps a single word:
+// an inline strong count tagged with the low bit, or, after the first weak reference was taken,
+// a pointer to a `WeakRefBlock`. Objects that are never weakly observed cost exactly as much as
+// with `RefCounted` and never allocate a block.
+//
+// `Counter` only selects the threading model (`SimpleCounter` or `AtomicCounter`); the count
+// itself lives in the tagged word, which is as wide as a pointer anyway, so the narrow counters
+// would save nothing and are rejected.
+template <typename Derived, typename Counter = SimpleCounter, typename Deleter = DefaultDelete>
+class RefCountedWithWeak {
+    static_assert(std::is_same_v<Counter, SimpleCounter> || std::is_same_v<Counter, AtomicCounter>,
+                  "The count is pointer-sized: use SimpleCounter or AtomicCounter");
+    static constexpr bool kThreadSafe = Counter::kThreadSafe;
+    static constexpr uintptr_t kInline = 1;
+    static constexpr uintptr_t kOne = 2;
+
+    template <typename T>
+    friend class IntrusiveWeakPtr;
+
+public:
+    RefCountedWithWeak() = default;
+    // A copy of an object is a new object: it starts without references or observers.
+    RefCountedWithWeak(const RefCountedWithWeak&) {
+    }
+    RefCountedWithWeak& operator=(const RefCountedWithWeak&) {
+        return *this;
+    }
+
+    // Increase reference counter.
+    void IncRef() {
+        uintptr_t bits = bits_.load(std::memory_order_acquire);
+        while (true) {
+            if (!(bits & kInline)) {
+                Increment(Block(bits)->strong);
+                return;
+            }
+            if (Replace(bits, bits + kOne, std::memory_order_acquire)) {
+                return;
+            }
+        }
+    }
+
+    // Decrease reference counter.
+    // Destroy object using Deleter when the last instance dies, and hand the side table, if any,
+    // over to the remaining observers.
+    void DecRef() {
+        uintptr_t bits = bits_.load(std::memory_order_acquire);
+        while (bits & kInline) {
+            if (Replace(bits, bits - kOne, std::memory_order_acq_rel)) {
+                if (bits - kOne == kInline) {
+                    Deleter::Destroy(static_cast<Derived*>(this));
+                }
+                return;
+            }
+        }
+        WeakRefBlock* block = Block(bits);
+        if (Decrement(block->strong) == 0) {
+            Deleter::Destroy(static_cast<Derived*>(this));
+            if (Decrement(block->weak) == 0) {
+                delete block;
+            }
+        }
+    }
+
+    // Get current counter value (the number of strong references).
+    size_t RefCount() const {
+        uintptr_t bits = bits_.load(std::memory_order_acquire);
+        if (bits & kInline) {
+            return bits >> 1;
+        }
+        return Block(bits)->strong.load(std::memory_order_relaxed);
+    }
+
+private:
+    static WeakRefBlock* Block(uintptr_t bits) {
+        return reinterpret_cast<WeakRefBlock*>(bits);
+    }
+
+    // Single-threaded policies compile these down to plain loads and stores. Loads of the tagged
+    // word acquire, since they may find a freshly published side table.
+    bool Replace(uintptr_t& expected, uintptr_t desired, std::memory_order order) {
+        if constexpr (kThreadSafe) {
+            return bits_.compare_exchange_weak(expected, desired, order, std::memory_order_acquire);
+        } else {
+            bits_.store(desired, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    static void Increment(std::atomic<size_t>& count) {
+        if constexpr (kThreadSafe) {
+            count.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+    }
+    static size_t Decrement(std::atomic<size_t>& count) {
+        if constexpr (kThreadSafe) {
+            return count.fetch_sub(1, std::memory_order_acq_rel) - 1;
+        } else {
+            size_t value = count.load(std::memory_order_relaxed) - 1;
+            count.store(value, std::memory_order_relaxed);
+            return value;
+        }
+    }
+    // Increment-if-nonzero, for promoting an observer.
+    static bool TryIncrement(std::atomic<size_t>& count) {
+        size_t value = count.load(std::memory_order_relaxed);
+        do {
+            if (value == 0) {
+                return false;
+            }
+        } while (!Store(count, value, value + 1));
+        return true;
+    }
+    static bool Store(std::atomic<size_t>& count, size_t& expected, size_t desired) {
+        if constexpr (kThreadSafe) {
+            return count.compare_exchange_weak(expected, desired, std::memory_order_acquire,
+                                               std::memory_order_relaxed);
+        } else {
+            count.store(desired, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    // Returns the side table with one more observer on it, creating it on first use.
+    // The caller holds a strong reference, so the object is alive throughout.
+    WeakRefBlock* Observe() {
+        uintptr_t bits = bits_.load(std::memory_order_acquire);
+        if (!(bits & kInline)) {
+            Increment(Block(bits)->weak);
+            return Block(bits);
+        }
+        auto* block = new WeakRefBlock{};
+        block->weak.store(2, std::memory_order_relaxed);
+        while (true) {
+            block->strong.store(bits >> 1, std::memory_order_relaxed);
+            if constexpr (kThreadSafe) {
+                if (bits_.compare_exchange_weak(bits, reinterpret_cast<uintptr_t>(block),
+                                                std::memory_order_acq_rel,
+                                                std::memory_order_acquire)) {
+                    return block;
+                }
+                if (!(bits & kInline)) {
+                    delete block;
+                    Increment(Block(bits)->weak);
+                    return Block(bits);
+                }
+            } else {
+                bits_.store(reinterpret_cast<uintptr_t>(block), std::memory_order_relaxed);
+                return block;
+            }
+        }
+    }
+
+    std::atomic<uintptr_t> bits_ = kInline;
+};
+
+// https://en.cppreference.com/w/cpp/memory/weak_ptr, for `RefCountedWithWeak` objects
+template <typename T>
+class IntrusiveWeakPtr {
+    template <typename Y>
+    friend class IntrusiveWeakPtr;
+
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    IntrusiveWeakPtr() {
+        ptr_ = nullptr;
+        block_ = nullptr;
+    }
+    IntrusiveWeakPtr(std::nullptr_t) {
+        ptr_ = nullptr;
+        block_ = nullptr;
+    }
+
+    // Demote `IntrusivePtr`
+    template <typename Y>
+    IntrusiveWeakPtr(const IntrusivePtr<Y>& other) {
+        static_assert(std::is_convertible_v<Y*, T*>, "Inconvertible types");
+        ptr_ = other.Get();
+        block_ = ptr_ != nullptr ? ptr_->Observe() : nullptr;
+    }
+
+    IntrusiveWeakPtr(const IntrusiveWeakPtr& other) {
+        ptr_ = other.ptr_;
+        block_ = other.block_;
+        Retain();
+    }
+    template <typename Y>
+    IntrusiveWeakPtr(const IntrusiveWeakPtr<Y>& other) {
+        static_assert(std::is_convertible_v<Y*, T*>, "Inconvertible types");
+        ptr_ = other.ptr_;
+        block_ = other.block_;
+        Retain();
+    }
+    IntrusiveWeakPtr(IntrusiveWeakPtr&& other) {
+        ptr_ = std::exchange(other.ptr_, nullptr);
+        block_ = std::exchange(other.block_, nullptr);
+    }
+    template <typename Y>
+    IntrusiveWeakPtr(IntrusiveWeakPtr<Y>&& other) {
+        static_assert(std::is_convertible_v<Y*, T*>, "Inconvertible types");
+        ptr_ = std::exchange(other.ptr_, nullptr);
+        block_ = std::exchange(other.block_, nullptr);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    IntrusiveWeakPtr& operator=(const IntrusiveWeakPtr& other) {
+        IntrusiveWeakPtr(other).Swap(*this);
+        return *this;
+    }
+    IntrusiveWeakPtr& operator=(IntrusiveWeakPtr&& other) {
+        IntrusiveWeakPtr(std::move(other)).Swap(*this);
+        return *this;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~IntrusiveWeakPtr() {
+        Reset();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    void Reset() {
+        if (WeakRefBlock* block = std::exchange(block_, nullptr)) {
+            if (T::Decrement(block->weak) == 0) {
+                delete block;
+            }
+        }
+        ptr_ = nullptr;
+    }
+    void Swap(IntrusiveWeakPtr& other) {
+        std::swap(ptr_, other.ptr_);
+        std::swap(block_, other.block_);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    size_t UseCount() const {
+        if (block_ == nullptr) {
+            return 0;
+        }
+        return block_->strong.load(std::memory_order_relaxed);
+    }
+    bool Expired() const {
+        return UseCount() == 0;
+    }
+    IntrusivePtr<T> Lock() const {
+        if (block_ == nullptr || !T::TryIncrement(block_->strong)) {
+            return IntrusivePtr<T>();
+        }
+        return IntrusivePtr<T>(ptr_, AdoptRef{});
+    }
+
+private:
+    void Retain() {
+        if (block_ != nullptr) {
+            T::Increment(block_->weak);
+        }
+    }
+
+    T* ptr_;
+    WeakRefBlock* block_;
+};
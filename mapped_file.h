@@ -0,0 +1,113 @@
+#pragma once
+
+#include "sw_fwd.h"  // Forward declaration
+#include "shared.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read-only file mappings with shared ownership. `MapFileShared` maps a whole file and returns it
+// as a `SharedPtr<const std::byte[]>` whose deleter unmaps it. Typed views made with `View` and
+// `ViewArray` alias that pointer: they copy nothing and keep the mapping alive on their own, so
+// consumers can hold sub-ranges of a huge index long after the `MappedFile` itself is gone.
+
+struct MapOptions {
+    // Fault the whole file in during `mmap` (`MAP_POPULATE`) instead of on first touch.
+    bool populate = false;
+    // `madvise` access pattern, e.g. `MADV_SEQUENTIAL`, `MADV_RANDOM` or `MADV_WILLNEED`.
+    int advice = MADV_NORMAL;
+    // Ask for transparent huge pages (`MADV_HUGEPAGE`). Best effort: most file systems map files
+    // with regular pages only.
+    bool huge_pages = false;
+};
+
+// Deleter of a mapping: `munmap` needs the length as well as the address.
+struct Unmap {
+    size_t length;
+
+    void operator()(const std::byte* data) const {
+        munmap(const_cast<std::byte*>(data), length);
+    }
+};
+
+struct MappedFile {
+    SharedPtr<const std::byte[]> bytes;
+    size_t size = 0;
+
+    std::span<const std::byte> Span() const {
+        return {bytes.Get(), size};
+    }
+
+    // The `R` stored at `offset`, sharing ownership of the mapping.
+    template <typename R>
+    SharedPtr<const R> View(size_t offset) const {
+        return SharedPtr<const R>(bytes, At<R>(offset, 1));
+    }
+
+    // `count` consecutive `R`s starting at `offset`, sharing ownership of the mapping.
+    template <typename R>
+    SharedPtr<const R[]> ViewArray(size_t offset, size_t count) const {
+        return SharedPtr<const R[]>(bytes, At<R>(offset, count));
+    }
+
+private:
+    template <typename R>
+    const R* At(size_t offset, size_t count) const {
+        static_assert(std::is_trivially_copyable_v<R>, "Only plain records can be viewed in place");
+        if (offset > size || count > (size - offset) / sizeof(R)) {
+            throw std::out_of_range("View is outside of the mapped file");
+        }
+        const std::byte* data = bytes.Get() + offset;
+        if (reinterpret_cast<uintptr_t>(data) % alignof(R) != 0) {
+            throw std::invalid_argument("View is misaligned for its type");
+        }
+        return reinterpret_cast<const R*>(data);
+    }
+};
+
+// Maps the file at `path` read-only. Throws `std::system_error` if it cannot be opened or mapped.
+// An empty file gives an empty `MappedFile`.
+inline MappedFile MapFileShared(const std::string& path, const MapOptions& options = {}) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "open " + path);
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        int error = errno;
+        close(fd);
+        throw std::system_error(error, std::generic_category(), "fstat " + path);
+    }
+    size_t size = static_cast<size_t>(info.st_size);
+    if (size == 0) {
+        close(fd);
+        return {};
+    }
+    int flags = MAP_PRIVATE | (options.populate ? MAP_POPULATE : 0);
+    void* memory = mmap(nullptr, size, PROT_READ, flags, fd, 0);
+    int error = errno;
+    close(fd);
+    if (memory == MAP_FAILED) {
+        throw std::system_error(error, std::generic_category(), "mmap " + path);
+    }
+    // Hints only: a kernel that does not take them maps the file all the same.
+    if (options.advice != MADV_NORMAL) {
+        madvise(memory, size, options.advice);
+    }
+    if (options.huge_pages) {
+        madvise(memory, size, MADV_HUGEPAGE);
+    }
+    auto* data = static_cast<const std::byte*>(memory);
+    return {SharedPtr<const std::byte[]>(data, Unmap{size}), size};
+}
@@ -0,0 +1,282 @@
+#pragma once
+
+#include "sw_fwd.h"  // Forward declaration
+#include "shared.h"
+#include "weak.h"
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+
+// Owner-based comparisons: two pointers are equal when they share a control block, whatever
+// they point at and whether or not the object is still alive. None of them allocates: a pointer
+// that was never shared is identified by its object, see `SharedPtr::Owner()`, so such a key
+// changes identity once it is shared. Keys of hashed containers must not be shared afterwards;
+// `OwnerMap` gives the keys it stores their block on insertion.
+// https://en.cppreference.com/w/cpp/memory/owner_less
+struct OwnerAccess {
+    template <typename T>
+    static const void* Owner(const SharedPtr<T>& ptr) {
+        return ptr.Owner();
+    }
+    template <typename T>
+    static const void* Owner(const WeakPtr<T>& ptr) {
+        return ptr.cb_;
+    }
+
+    // The control block the pointer already has, if any.
+    template <typename T>
+    static const ControlBlockBase* Block(const SharedPtr<T>& ptr) {
+        return SharedPtr<T>::Deferred(ptr.cb_) ? nullptr : ptr.cb_;
+    }
+
+    // The control block a copy of the pointer shares.
+    template <typename T>
+    static const ControlBlockBase* Shared(const SharedPtr<T>& ptr) {
+        return SharedPtr<T>::ShareBlock(ptr);
+    }
+    template <typename T>
+    static const ControlBlockBase* Shared(const WeakPtr<T>& ptr) {
+        return ptr.cb_;
+    }
+};
+
+struct OwnerLess {
+    using is_transparent = void;
+
+    template <typename L, typename R>
+    bool operator()(const L& left, const R& right) const {
+        return left.OwnerBefore(right);
+    }
+};
+
+struct OwnerEqual {
+    using is_transparent = void;
+
+    template <typename L, typename R>
+    bool operator()(const L& left, const R& right) const {
+        return OwnerAccess::Owner(left) == OwnerAccess::Owner(right);
+    }
+};
+
+struct OwnerHash {
+    using is_transparent = void;
+
+    template <typename P>
+    size_t operator()(const P& ptr) const {
+        return MixPointer(OwnerAccess::Owner(ptr));
+    }
+};
+
+// Flat open-addressing map keyed by ownership. `K` is a `SharedPtr` or a `WeakPtr`; lookups accept
+// either. Keys are hashed by control block address, which stays valid for expired `WeakPtr` keys
+// since they keep the block itself alive. Empty pointers have no owner and cannot be keys.
+//
+// Linear probing with backward-shift deletion, so there are no tombstones.
+template <typename K, typename V>
+class OwnerMap {
+    struct Slot {
+        const ControlBlockBase* owner = nullptr;
+        alignas(std::pair<K, V>) unsigned char buf_[sizeof(std::pair<K, V>)];
+
+        std::pair<K, V>& Entry() {
+            return *std::launder(reinterpret_cast<std::pair<K, V>*>(&buf_));
+        }
+    };
+
+public:
+    OwnerMap() = default;
+
+    OwnerMap(const OwnerMap& other) = delete;
+    OwnerMap& operator=(const OwnerMap& other) = delete;
+
+    OwnerMap(OwnerMap&& other) noexcept
+        : slots_(std::exchange(other.slots_, nullptr)),
+          capacity_(std::exchange(other.capacity_, 0)),
+          size_(std::exchange(other.size_, 0)) {
+    }
+    OwnerMap& operator=(OwnerMap&& other) noexcept {
+        if (this != &other) {
+            Clear();
+            delete[] slots_;
+            slots_ = std::exchange(other.slots_, nullptr);
+            capacity_ = std::exchange(other.capacity_, 0);
+            size_ = std::exchange(other.size_, 0);
+        }
+        return *this;
+    }
+
+    ~OwnerMap() {
+        Clear();
+        delete[] slots_;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Lookup
+
+    template <typename P>
+    V* Find(const P& key) {
+        const void* owner = OwnerAccess::Owner(key);
+        if (owner == nullptr || size_ == 0) {
+            return nullptr;
+        }
+        for (size_t i = Home(owner);; i = Next(i)) {
+            if (slots_[i].owner == owner) {
+                return &slots_[i].Entry().second;
+            }
+            if (slots_[i].owner == nullptr) {
+                return nullptr;
+            }
+        }
+    }
+    template <typename P>
+    const V* Find(const P& key) const {
+        return const_cast<OwnerMap*>(this)->Find(key);
+    }
+    template <typename P>
+    bool Contains(const P& key) const {
+        return Find(key) != nullptr;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    // Returns the value stored for `key` and whether it was inserted by this call.
+    template <typename... Args>
+    std::pair<V*, bool> TryEmplace(const K& key, Args&&... args) {
+        // The stored copy shares the block anyway; taking it first keeps the key's identity.
+        const ControlBlockBase* owner = OwnerAccess::Shared(key);
+        assert(owner != nullptr && "Empty pointers have no owner");
+        // Looking up first: a key that is already there must not move the entries.
+        if (V* found = Find(key)) {
+            return {found, false};
+        }
+        if ((size_ + 1) * 8 > capacity_ * 7) {
+            Rehash(capacity_ == 0 ? 16 : capacity_ * 2);
+        }
+        size_t i = Home(owner);
+        while (slots_[i].owner != nullptr) {
+            i = Next(i);
+        }
+        new (&slots_[i].buf_) std::pair<K, V>(std::piecewise_construct, std::forward_as_tuple(key),
+                                              std::forward_as_tuple(std::forward<Args>(args)...));
+        slots_[i].owner = owner;
+        ++size_;
+        return {&slots_[i].Entry().second, true};
+    }
+
+    V& operator[](const K& key) {
+        return *TryEmplace(key).first;
+    }
+
+    template <typename P>
+    bool Erase(const P& key) {
+        const void* owner = OwnerAccess::Owner(key);
+        if (owner == nullptr || size_ == 0) {
+            return false;
+        }
+        for (size_t i = Home(owner); slots_[i].owner != nullptr; i = Next(i)) {
+            if (slots_[i].owner == owner) {
+                EraseSlot(i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Drops every entry whose key no longer has a live object.
+    size_t PurgeExpired() {
+        size_t purged = 0;
+        for (size_t i = 0; i < capacity_;) {
+            if (slots_[i].owner != nullptr && slots_[i].owner->strong_counter_ == 0) {
+                EraseSlot(i);
+                ++purged;
+            } else {
+                ++i;
+            }
+        }
+        return purged;
+    }
+
+    void Clear() {
+        for (size_t i = 0; i < capacity_; ++i) {
+            if (slots_[i].owner != nullptr) {
+                slots_[i].Entry().~pair();
+                slots_[i].owner = nullptr;
+            }
+        }
+        size_ = 0;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    size_t Size() const {
+        return size_;
+    }
+    bool Empty() const {
+        return size_ == 0;
+    }
+
+    // Calls `f(key, value)` for every entry, in unspecified order.
+    template <typename F>
+    void ForEach(F&& f) {
+        for (size_t i = 0; i < capacity_; ++i) {
+            if (slots_[i].owner != nullptr) {
+                auto& entry = slots_[i].Entry();
+                f(std::as_const(entry.first), entry.second);
+            }
+        }
+    }
+
+private:
+    size_t Home(const void* owner) const {
+        return MixPointer(owner) & (capacity_ - 1);
+    }
+    size_t Next(size_t i) const {
+        return (i + 1) & (capacity_ - 1);
+    }
+
+    // Removes slot `i` and shifts the following entries of the probe run back into the gap.
+    void EraseSlot(size_t i) {
+        slots_[i].Entry().~pair();
+        slots_[i].owner = nullptr;
+        --size_;
+        for (size_t j = Next(i); slots_[j].owner != nullptr; j = Next(j)) {
+            size_t home = Home(slots_[j].owner);
+            // Move `j` into the gap unless its home lies cyclically in (i, j].
+            bool stays = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+            if (stays) {
+                continue;
+            }
+            new (&slots_[i].buf_) std::pair<K, V>(std::move(slots_[j].Entry()));
+            slots_[i].owner = slots_[j].owner;
+            slots_[j].Entry().~pair();
+            slots_[j].owner = nullptr;
+            i = j;
+        }
+    }
+
+    void Rehash(size_t capacity) {
+        Slot* old_slots = std::exchange(slots_, new Slot[capacity]);
+        size_t old_capacity = std::exchange(capacity_, capacity);
+        for (size_t i = 0; i < old_capacity; ++i) {
+            if (old_slots[i].owner == nullptr) {
+                continue;
+            }
+            size_t j = Home(old_slots[i].owner);
+            while (slots_[j].owner != nullptr) {
+                j = Next(j);
+            }
+            new (&slots_[j].buf_) std::pair<K, V>(std::move(old_slots[i].Entry()));
+            slots_[j].owner = old_slots[i].owner;
+            old_slots[i].Entry().~pair();
+        }
+        delete[] old_slots;
+    }
+
+    Slot* slots_ = nullptr;
+    size_t capacity_ = 0;
+    size_t size_ = 0;
+};
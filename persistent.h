@@ -0,0 +1,793 @@
+#pragma once
+
+#include "sw_fwd.h"  // Forward declaration
+#include "intrusive.h"
+
+#include <bit>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <new>
+#include <span>
+#include <stdexcept>
+#include <utility>
+
+// Persistent collections: every update returns a new version and leaves the old one intact, and
+// the versions share all nodes the update did not touch, so keeping a snapshot per request costs
+// a few nodes instead of a copy of the whole collection. `PersistentVector` is a 32-way trie with
+// the last leaf kept aside as a tail; `PersistentHashMap` is a hash array mapped trie (HAMT).
+//
+// Nodes are counted by `IntrusivePtr`, and the count says who else can see a node: one that only
+// this version reaches is changed in place, any other is copied first along with the path to it.
+// A `Transient()` builds on that for batches: its first update copies the path it touches, and
+// later updates change those copies in place instead of copying again. `Persistent()` turns it
+// back into a version that is shared as usual.
+//
+// Like `SharedPtr`, the versions of one collection must stay within a thread.
+
+// Makes `node` safe to change in place: a node that other versions reach is replaced with a copy.
+template <typename Node>
+Node* UniqueNode(IntrusivePtr<Node>& node) {
+    if (node->RefCount() != 1) {
+        node = node->Clone();
+    }
+    return node.Get();
+}
+
+template <typename T>
+class TransientVector;
+
+template <typename K, typename V, typename Hash, typename Equal>
+class TransientHashMap;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Vector
+
+template <typename T>
+class PersistentVector {
+    friend class TransientVector<T>;
+
+    static constexpr size_t kBits = 5;
+    static constexpr size_t kWidth = size_t{1} << kBits;
+    static constexpr size_t kMask = kWidth - 1;
+
+    struct Node : public SimpleRefCounted<Node> {
+        virtual ~Node() = default;
+        virtual IntrusivePtr<Node> Clone() const = 0;
+    };
+
+    struct Branch : public Node {
+        IntrusivePtr<Node> Clone() const override {
+            return MakeIntrusive<Branch>(*this);
+        }
+
+        IntrusivePtr<Node> children[kWidth];
+    };
+
+    // Up to `kWidth` elements, constructed in place so that `T` needs no default constructor.
+    struct Leaf : public Node {
+        Leaf() = default;
+        Leaf(const Leaf& other) : Node(other) {
+            std::uninitialized_copy_n(other.Values(), other.size, Values());
+            size = other.size;
+        }
+        ~Leaf() override {
+            std::destroy_n(Values(), size);
+        }
+
+        IntrusivePtr<Node> Clone() const override {
+            return MakeIntrusive<Leaf>(*this);
+        }
+
+        T* Values() {
+            return std::launder(reinterpret_cast<T*>(storage));
+        }
+        const T* Values() const {
+            return std::launder(reinterpret_cast<const T*>(storage));
+        }
+        template <typename... Args>
+        void Emplace(Args&&... args) {
+            new (Values() + size) T(std::forward<Args>(args)...);
+            ++size;
+        }
+        void Pop() {
+            std::destroy_at(Values() + --size);
+        }
+
+        alignas(T) unsigned char storage[kWidth * sizeof(T)];
+        size_t size = 0;
+    };
+
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    PersistentVector() = default;
+    PersistentVector(const PersistentVector&) = default;
+    PersistentVector(PersistentVector&& other)
+        : size_(std::exchange(other.size_, 0)),
+          shift_(std::exchange(other.shift_, kBits)),
+          root_(std::move(other.root_)),
+          tail_(std::move(other.tail_)) {
+    }
+
+    PersistentVector& operator=(const PersistentVector& other) {
+        PersistentVector(other).Swap(*this);
+        return *this;
+    }
+    PersistentVector& operator=(PersistentVector&& other) {
+        PersistentVector(std::move(other)).Swap(*this);
+        return *this;
+    }
+
+    void Swap(PersistentVector& other) {
+        std::swap(size_, other.size_);
+        std::swap(shift_, other.shift_);
+        root_.Swap(other.root_);
+        tail_.Swap(other.tail_);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Updates
+
+    PersistentVector PushBack(T value) const {
+        PersistentVector result = *this;
+        result.DoEmplaceBack(std::move(value));
+        return result;
+    }
+    PersistentVector Set(size_t index, T value) const {
+        PersistentVector result = *this;
+        result.DoSet(index, std::move(value));
+        return result;
+    }
+    PersistentVector PopBack() const {
+        PersistentVector result = *this;
+        result.DoPopBack();
+        return result;
+    }
+
+    TransientVector<T> Transient() const {
+        return TransientVector<T>(*this);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    const T& operator[](size_t index) const {
+        assert(index < size_ && "Index out of range");
+        return LeafFor(index)->Values()[index & kMask];
+    }
+    const T& At(size_t index) const {
+        if (index >= size_) {
+            throw std::out_of_range("PersistentVector index is out of range");
+        }
+        return (*this)[index];
+    }
+    const T& Back() const {
+        return (*this)[size_ - 1];
+    }
+    size_t Size() const {
+        return size_;
+    }
+    bool Empty() const {
+        return size_ == 0;
+    }
+
+    // Calls `visit` on every element in order, one leaf lookup per 32 elements.
+    template <typename F>
+    void ForEach(F&& visit) const {
+        for (size_t start = 0; start < size_; start += kWidth) {
+            const Leaf* leaf = LeafFor(start);
+            for (size_t i = 0; i < leaf->size; ++i) {
+                visit(leaf->Values()[i]);
+            }
+        }
+    }
+
+private:
+    // Index of the first element in the tail.
+    size_t TailOffset() const {
+        return size_ < kWidth ? 0 : (size_ - 1) >> kBits << kBits;
+    }
+
+    const Leaf* LeafFor(size_t index) const {
+        if (index >= TailOffset()) {
+            return static_cast<const Leaf*>(tail_.Get());
+        }
+        const Node* node = root_.Get();
+        for (size_t level = shift_; level > 0; level -= kBits) {
+            node = static_cast<const Branch*>(node)->children[(index >> level) & kMask].Get();
+        }
+        return static_cast<const Leaf*>(node);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // In-place updates, shared by both modes
+
+    template <typename... Args>
+    T& DoEmplaceBack(Args&&... args) {
+        if (tail_ && size_ - TailOffset() == kWidth) {
+            // The element goes into a new leaf first, so a throwing constructor changes nothing.
+            auto leaf = MakeIntrusive<Leaf>();
+            leaf->Emplace(std::forward<Args>(args)...);
+            PushTail();
+            tail_ = std::move(leaf);
+        } else {
+            if (!tail_) {
+                tail_ = MakeIntrusive<Leaf>();
+            }
+            static_cast<Leaf*>(UniqueNode(tail_))->Emplace(std::forward<Args>(args)...);
+        }
+        ++size_;
+        return static_cast<Leaf*>(tail_.Get())->Values()[(size_ - 1) & kMask];
+    }
+
+    // Moves the full tail into the trie, growing it by a level when the root is full.
+    void PushTail() {
+        if (!root_) {
+            root_ = MakeIntrusive<Branch>();
+            shift_ = kBits;
+        } else if ((size_ >> kBits) > (size_t{1} << shift_)) {
+            auto root = MakeIntrusive<Branch>();
+            root->children[0] = std::move(root_);
+            root_ = std::move(root);
+            shift_ += kBits;
+        }
+        Node* node = UniqueNode(root_);
+        size_t index = size_ - 1;
+        for (size_t level = shift_; level > kBits; level -= kBits) {
+            auto& child = static_cast<Branch*>(node)->children[(index >> level) & kMask];
+            if (!child) {
+                child = MakeIntrusive<Branch>();
+            }
+            node = UniqueNode(child);
+        }
+        static_cast<Branch*>(node)->children[(index >> kBits) & kMask] = std::move(tail_);
+    }
+
+    T& DoMutable(size_t index) {
+        assert(index < size_ && "Index out of range");
+        if (index >= TailOffset()) {
+            return static_cast<Leaf*>(UniqueNode(tail_))->Values()[index & kMask];
+        }
+        Node* node = UniqueNode(root_);
+        for (size_t level = shift_; level > 0; level -= kBits) {
+            node = UniqueNode(static_cast<Branch*>(node)->children[(index >> level) & kMask]);
+        }
+        return static_cast<Leaf*>(node)->Values()[index & kMask];
+    }
+    void DoSet(size_t index, T value) {
+        if (index >= size_) {
+            throw std::out_of_range("PersistentVector index is out of range");
+        }
+        DoMutable(index) = std::move(value);
+    }
+
+    void DoPopBack() {
+        assert(size_ != 0 && "PopBack from an empty vector");
+        if (size_ - TailOffset() > 1) {
+            static_cast<Leaf*>(UniqueNode(tail_))->Pop();
+        } else if (size_ == 1) {
+            tail_.Reset();
+        } else {
+            // The tail empties: the last leaf of the trie takes its place.
+            IntrusivePtr<Node> leaf(const_cast<Leaf*>(LeafFor(size_ - 2)));
+            if (PopLeaf(UniqueNode(root_), shift_, size_ - 2)) {
+                root_.Reset();
+                shift_ = kBits;
+            } else if (auto* root = static_cast<Branch*>(root_.Get());
+                       shift_ > kBits && !root->children[1]) {
+                IntrusivePtr<Node> child = std::move(root->children[0]);
+                root_ = std::move(child);
+                shift_ -= kBits;
+            }
+            tail_ = std::move(leaf);
+        }
+        --size_;
+    }
+
+    // Unlinks the leaf holding `index` below `node`. Returns true if that left `node` empty.
+    static bool PopLeaf(Node* node, size_t level, size_t index) {
+        auto* branch = static_cast<Branch*>(node);
+        size_t slot = (index >> level) & kMask;
+        if (level > kBits && !PopLeaf(UniqueNode(branch->children[slot]), level - kBits, index)) {
+            return false;
+        }
+        branch->children[slot].Reset();
+        return slot == 0;
+    }
+
+    size_t size_ = 0;
+    size_t shift_ = kBits;
+    IntrusivePtr<Node> root_;
+    IntrusivePtr<Node> tail_;
+};
+
+// Batch of updates to a `PersistentVector`, applied in place wherever the nodes are its own.
+template <typename T>
+class TransientVector {
+    friend class PersistentVector<T>;
+
+public:
+    TransientVector(const TransientVector&) = delete;
+    TransientVector(TransientVector&&) = default;
+    TransientVector& operator=(const TransientVector&) = delete;
+    TransientVector& operator=(TransientVector&&) = default;
+
+    void PushBack(T value) {
+        vector_.DoEmplaceBack(std::move(value));
+    }
+    template <typename... Args>
+    T& EmplaceBack(Args&&... args) {
+        return vector_.DoEmplaceBack(std::forward<Args>(args)...);
+    }
+    void Set(size_t index, T value) {
+        vector_.DoSet(index, std::move(value));
+    }
+    // Writable element, copying the nodes on its path if another version shares them.
+    T& Mutable(size_t index) {
+        return vector_.DoMutable(index);
+    }
+    void PopBack() {
+        vector_.DoPopBack();
+    }
+
+    const T& operator[](size_t index) const {
+        return vector_[index];
+    }
+    size_t Size() const {
+        return vector_.Size();
+    }
+
+    PersistentVector<T> Persistent() && {
+        return std::move(vector_);
+    }
+
+private:
+    explicit TransientVector(PersistentVector<T> vector) : vector_(std::move(vector)) {
+    }
+
+    PersistentVector<T> vector_;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Hash map
+
+template <typename K, typename V, typename Hash = std::hash<K>, typename Equal = std::equal_to<K>>
+class PersistentHashMap {
+    friend class TransientHashMap<K, V, Hash, Equal>;
+
+    static constexpr size_t kBits = 5;
+    static constexpr size_t kMask = (size_t{1} << kBits) - 1;
+    // Nodes this deep have used up the hash: they list colliding entries in any order.
+    static constexpr size_t kCollisionShift = std::numeric_limits<size_t>::digits;
+
+    struct Entry {
+        size_t hash;
+        K key;
+        V value;
+    };
+
+    // Bitmap-indexed node: a bit of `data_map` marks a slot holding an entry, a bit of `node_map`
+    // one holding a child. Children and then entries follow the node in the same allocation,
+    // ordered by slot and sized exactly, so a lookup touches one block per level. Collision nodes
+    // have neither map and only entries.
+    struct Node : public SimpleRefCounted<Node> {
+        static_assert(alignof(Entry) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__,
+                      "Over-aligned entries are not supported");
+
+        // Room for the children of `node_map` and `entries` entries. The caller adds them.
+        static IntrusivePtr<Node> Make(uint32_t data_map, uint32_t node_map, size_t entries) {
+            size_t bytes = EntriesOffset(node_map) + entries * sizeof(Entry);
+            return IntrusivePtr<Node>(new (::operator new(bytes)) Node(data_map, node_map));
+        }
+
+        Node(const Node&) = delete;
+        Node& operator=(const Node&) = delete;
+        ~Node() {
+            std::destroy_n(Children(), child_count);
+            std::destroy_n(Entries(), entry_count);
+        }
+
+        // Allocated larger than `Node`, see `Make`.
+        static void operator delete(void* memory) {
+            ::operator delete(memory);
+        }
+
+        IntrusivePtr<Node> Clone() const {
+            IntrusivePtr<Node> copy = Make(data_map, node_map, entry_count);
+            for (const IntrusivePtr<Node>& child : ChildSpan()) {
+                copy->AddChild(child);
+            }
+            for (const Entry& entry : EntrySpan()) {
+                copy->AddEntry(entry);
+            }
+            return copy;
+        }
+
+        IntrusivePtr<Node>* Children() {
+            return std::launder(reinterpret_cast<IntrusivePtr<Node>*>(this + 1));
+        }
+        const IntrusivePtr<Node>* Children() const {
+            return std::launder(reinterpret_cast<const IntrusivePtr<Node>*>(this + 1));
+        }
+        Entry* Entries() {
+            auto* entries = reinterpret_cast<char*>(this) + EntriesOffset(node_map);
+            return std::launder(reinterpret_cast<Entry*>(entries));
+        }
+        const Entry* Entries() const {
+            auto* entries = reinterpret_cast<const char*>(this) + EntriesOffset(node_map);
+            return std::launder(reinterpret_cast<const Entry*>(entries));
+        }
+        std::span<const IntrusivePtr<Node>> ChildSpan() const {
+            return {Children(), child_count};
+        }
+        std::span<const Entry> EntrySpan() const {
+            return {Entries(), entry_count};
+        }
+
+        template <typename C>
+        void AddChild(C&& child) {
+            new (Children() + child_count) IntrusivePtr<Node>(std::forward<C>(child));
+            ++child_count;
+        }
+        template <typename E>
+        void AddEntry(E&& entry) {
+            new (Entries() + entry_count) Entry(std::forward<E>(entry));
+            ++entry_count;
+        }
+
+        uint32_t data_map;
+        uint32_t node_map;
+        // Constructed so far; the destructor relies on them if filling the node fails.
+        uint32_t child_count = 0;
+        uint32_t entry_count = 0;
+
+    private:
+        Node(uint32_t data_map, uint32_t node_map) : data_map(data_map), node_map(node_map) {
+        }
+
+        static size_t EntriesOffset(uint32_t node_map) {
+            size_t end = sizeof(Node) + std::popcount(node_map) * sizeof(IntrusivePtr<Node>);
+            return (end + alignof(Entry) - 1) / alignof(Entry) * alignof(Entry);
+        }
+    };
+
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    PersistentHashMap() = default;
+    PersistentHashMap(const PersistentHashMap&) = default;
+    PersistentHashMap(PersistentHashMap&& other)
+        : size_(std::exchange(other.size_, 0)), root_(std::move(other.root_)) {
+    }
+
+    PersistentHashMap& operator=(const PersistentHashMap& other) {
+        PersistentHashMap(other).Swap(*this);
+        return *this;
+    }
+    PersistentHashMap& operator=(PersistentHashMap&& other) {
+        PersistentHashMap(std::move(other)).Swap(*this);
+        return *this;
+    }
+
+    void Swap(PersistentHashMap& other) {
+        std::swap(size_, other.size_);
+        root_.Swap(other.root_);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Updates
+
+    // The key bound to `value`, whether it was there before or not.
+    PersistentHashMap Set(K key, V value) const {
+        PersistentHashMap result = *this;
+        result.DoSet(std::move(key), std::move(value));
+        return result;
+    }
+    PersistentHashMap Erase(const K& key) const {
+        if (!Contains(key)) {
+            return *this;
+        }
+        PersistentHashMap result = *this;
+        result.DoErase(key);
+        return result;
+    }
+
+    TransientHashMap<K, V, Hash, Equal> Transient() const {
+        return TransientHashMap<K, V, Hash, Equal>(*this);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    // The value bound to `key`, or `nullptr`.
+    const V* Find(const K& key) const {
+        if (!root_) {
+            return nullptr;
+        }
+        size_t hash = Hash{}(key);
+        const Node* node = root_.Get();
+        for (size_t shift = 0; shift < kCollisionShift; shift += kBits) {
+            uint32_t bit = Bit(hash, shift);
+            if (node->data_map & bit) {
+                const Entry& entry = node->Entries()[Index(node->data_map, bit)];
+                return entry.hash == hash && Equal{}(entry.key, key) ? &entry.value : nullptr;
+            }
+            if (!(node->node_map & bit)) {
+                return nullptr;
+            }
+            node = node->Children()[Index(node->node_map, bit)].Get();
+        }
+        for (const Entry& entry : node->EntrySpan()) {
+            if (Equal{}(entry.key, key)) {
+                return &entry.value;
+            }
+        }
+        return nullptr;
+    }
+    bool Contains(const K& key) const {
+        return Find(key) != nullptr;
+    }
+    const V& At(const K& key) const {
+        if (const V* value = Find(key)) {
+            return *value;
+        }
+        throw std::out_of_range("PersistentHashMap has no such key");
+    }
+
+    size_t Size() const {
+        return size_;
+    }
+    bool Empty() const {
+        return size_ == 0;
+    }
+
+    // Calls `visit(key, value)` on every entry, in no particular order.
+    template <typename F>
+    void ForEach(F&& visit) const {
+        if (root_) {
+            Visit(root_.Get(), visit);
+        }
+    }
+
+private:
+    static uint32_t Bit(size_t hash, size_t shift) {
+        return uint32_t{1} << ((hash >> shift) & kMask);
+    }
+    // Position of the slot marked by `bit` among the slots present in `map`.
+    static size_t Index(uint32_t map, uint32_t bit) {
+        return static_cast<size_t>(std::popcount(map & (bit - 1)));
+    }
+
+    template <typename F>
+    static void Visit(const Node* node, F& visit) {
+        for (const Entry& entry : node->EntrySpan()) {
+            visit(entry.key, entry.value);
+        }
+        for (const IntrusivePtr<Node>& child : node->ChildSpan()) {
+            Visit(child.Get(), visit);
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // In-place updates, shared by both modes
+    //
+    // Nodes are sized exactly, so adding or removing a slot replaces the node even when it is
+    // unique. The slots of a unique node are moved into its replacement rather than copied.
+
+    void DoSet(K key, V value) {
+        size_t hash = Hash{}(key);
+        if (!root_) {
+            root_ = Node::Make(0, 0, 0);
+        }
+        if (Insert(root_, 0, Entry{hash, std::move(key), std::move(value)})) {
+            ++size_;
+        }
+    }
+    bool DoErase(const K& key) {
+        if (!root_ || !Remove(root_, 0, Hash{}(key), key)) {
+            return false;
+        }
+        if (--size_ == 0) {
+            root_.Reset();
+        }
+        return true;
+    }
+
+    // Returns true if the key is new.
+    static bool Insert(IntrusivePtr<Node>& slot, size_t shift, Entry&& entry) {
+        Node* node = slot.Get();
+        bool unique = node->RefCount() == 1;
+        if (shift >= kCollisionShift) {
+            for (uint32_t i = 0; i < node->entry_count; ++i) {
+                if (Equal{}(node->Entries()[i].key, entry.key)) {
+                    UniqueNode(slot)->Entries()[i].value = std::move(entry.value);
+                    return false;
+                }
+            }
+            slot = WithCollision(*node, unique, node->entry_count, &entry);
+            return true;
+        }
+        uint32_t bit = Bit(entry.hash, shift);
+        if (node->node_map & bit) {
+            node = UniqueNode(slot);
+            return Insert(node->Children()[Index(node->node_map, bit)], shift + kBits,
+                          std::move(entry));
+        }
+        if (!(node->data_map & bit)) {
+            slot = Rebuild(*node, unique, node->data_map | bit, node->node_map, bit, &entry,
+                           nullptr);
+            return true;
+        }
+        size_t index = Index(node->data_map, bit);
+        const Entry& existing = node->Entries()[index];
+        if (existing.hash == entry.hash && Equal{}(existing.key, entry.key)) {
+            UniqueNode(slot)->Entries()[index].value = std::move(entry.value);
+            return false;
+        }
+        // Two keys in one slot: both move into a child that tells them apart further down.
+        Entry moved = unique ? std::move(node->Entries()[index]) : existing;
+        IntrusivePtr<Node> child = Merge(std::move(moved), std::move(entry), shift + kBits);
+        slot = Rebuild(*node, unique, node->data_map ^ bit, node->node_map | bit, bit, nullptr,
+                       &child);
+        return true;
+    }
+
+    static IntrusivePtr<Node> Merge(Entry&& first, Entry&& second, size_t shift) {
+        if (shift >= kCollisionShift) {
+            IntrusivePtr<Node> node = Node::Make(0, 0, 2);
+            node->AddEntry(std::move(first));
+            node->AddEntry(std::move(second));
+            return node;
+        }
+        uint32_t first_bit = Bit(first.hash, shift);
+        uint32_t second_bit = Bit(second.hash, shift);
+        if (first_bit == second_bit) {
+            IntrusivePtr<Node> child = Merge(std::move(first), std::move(second), shift + kBits);
+            IntrusivePtr<Node> node = Node::Make(0, first_bit, 0);
+            node->AddChild(std::move(child));
+            return node;
+        }
+        IntrusivePtr<Node> node = Node::Make(first_bit | second_bit, 0, 2);
+        if (first_bit < second_bit) {
+            node->AddEntry(std::move(first));
+            node->AddEntry(std::move(second));
+        } else {
+            node->AddEntry(std::move(second));
+            node->AddEntry(std::move(first));
+        }
+        return node;
+    }
+
+    // Returns true if the key was there.
+    static bool Remove(IntrusivePtr<Node>& slot, size_t shift, size_t hash, const K& key) {
+        Node* node = slot.Get();
+        bool unique = node->RefCount() == 1;
+        if (shift >= kCollisionShift) {
+            for (uint32_t i = 0; i < node->entry_count; ++i) {
+                if (Equal{}(node->Entries()[i].key, key)) {
+                    slot = WithCollision(*node, unique, i, nullptr);
+                    return true;
+                }
+            }
+            return false;
+        }
+        uint32_t bit = Bit(hash, shift);
+        if (node->data_map & bit) {
+            const Entry& entry = node->Entries()[Index(node->data_map, bit)];
+            if (entry.hash != hash || !Equal{}(entry.key, key)) {
+                return false;
+            }
+            slot = Rebuild(*node, unique, node->data_map ^ bit, node->node_map, bit, nullptr,
+                           nullptr);
+            return true;
+        }
+        if (!(node->node_map & bit)) {
+            return false;
+        }
+        node = UniqueNode(slot);
+        IntrusivePtr<Node>& child = node->Children()[Index(node->node_map, bit)];
+        if (!Remove(child, shift + kBits, hash, key)) {
+            return false;
+        }
+        // A child left with a single entry is folded back into this node.
+        if (child->child_count == 0 && child->entry_count == 1) {
+            Entry entry = child->RefCount() == 1 ? std::move(child->Entries()[0])
+                                                 : Entry(child->Entries()[0]);
+            slot = Rebuild(*node, true, node->data_map | bit, node->node_map ^ bit, bit, &entry,
+                           nullptr);
+        }
+        return true;
+    }
+
+    // Node with the slots of `data_map` and `node_map`. The slot at `bit` is filled from `entry`
+    // or `child` if given, every other one from the same slot of `source`, moved out of it if
+    // `steal`.
+    static IntrusivePtr<Node> Rebuild(Node& source, bool steal, uint32_t data_map,
+                                      uint32_t node_map, uint32_t bit, Entry* entry,
+                                      IntrusivePtr<Node>* child) {
+        IntrusivePtr<Node> node = Node::Make(data_map, node_map, std::popcount(data_map));
+        for (uint32_t map = node_map; map != 0; map &= map - 1) {
+            uint32_t next = map & (~map + 1);
+            if (next == bit && child != nullptr) {
+                node->AddChild(std::move(*child));
+                continue;
+            }
+            IntrusivePtr<Node>& from = source.Children()[Index(source.node_map, next)];
+            steal ? node->AddChild(std::move(from)) : node->AddChild(from);
+        }
+        for (uint32_t map = data_map; map != 0; map &= map - 1) {
+            uint32_t next = map & (~map + 1);
+            if (next == bit && entry != nullptr) {
+                node->AddEntry(std::move(*entry));
+                continue;
+            }
+            Entry& from = source.Entries()[Index(source.data_map, next)];
+            steal ? node->AddEntry(std::move(from)) : node->AddEntry(from);
+        }
+        return node;
+    }
+
+    // Collision node with the entries of `source`, either without the one at `index` or with
+    // `entry` added at the end.
+    static IntrusivePtr<Node> WithCollision(Node& source, bool steal, uint32_t index,
+                                            Entry* entry) {
+        uint32_t count = entry != nullptr ? source.entry_count + 1 : source.entry_count - 1;
+        IntrusivePtr<Node> node = Node::Make(0, 0, count);
+        for (uint32_t i = 0; i < source.entry_count; ++i) {
+            if (i != index) {
+                Entry& from = source.Entries()[i];
+                steal ? node->AddEntry(std::move(from)) : node->AddEntry(from);
+            }
+        }
+        if (entry != nullptr) {
+            node->AddEntry(std::move(*entry));
+        }
+        return node;
+    }
+
+    size_t size_ = 0;
+    IntrusivePtr<Node> root_;
+};
+
+// Batch of updates to a `PersistentHashMap`, applied in place wherever the nodes are its own.
+template <typename K, typename V, typename Hash, typename Equal>
+class TransientHashMap {
+    friend class PersistentHashMap<K, V, Hash, Equal>;
+
+public:
+    TransientHashMap(const TransientHashMap&) = delete;
+    TransientHashMap(TransientHashMap&&) = default;
+    TransientHashMap& operator=(const TransientHashMap&) = delete;
+    TransientHashMap& operator=(TransientHashMap&&) = default;
+
+    void Set(K key, V value) {
+        map_.DoSet(std::move(key), std::move(value));
+    }
+    // Returns true if the key was there.
+    bool Erase(const K& key) {
+        return map_.DoErase(key);
+    }
+
+    const V* Find(const K& key) const {
+        return map_.Find(key);
+    }
+    size_t Size() const {
+        return map_.Size();
+    }
+
+    PersistentHashMap<K, V, Hash, Equal> Persistent() && {
+        return std::move(map_);
+    }
+
+private:
+    explicit TransientHashMap(PersistentHashMap<K, V, Hash, Equal> map) : map_(std::move(map)) {
+    }
+
+    PersistentHashMap<K, V, Hash, Equal> map_;
+};
@@ -0,0 +1,242 @@
+#pragma once
+
+#include "sw_fwd.h"  // Forward declaration
+#include "intrusive.h"
+#include "shared.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+// Recycling pools for objects that are expensive to build. `ObjectPool<T>::Acquire()` hands out
+// a `SharedPtr<T>`, or an `IntrusivePtr<T>` when `T` derives from `PooledRefCounted<T>`. When the
+// last reference drops the object is not destroyed: it gets `Reset()` (when it has one) and goes
+// back to the pool's free list, together with its control block in the `SharedPtr` case.
+//
+// A pool and its free list are not synchronized: keep one pool per thread (e.g. `thread_local`)
+// and let the last reference to a pooled object drop on that thread. The pool may die before the
+// objects it handed out; those are then destroyed normally.
+
+struct PoolStats {
+    size_t hits = 0;      // `Acquire()` served from the free list
+    size_t misses = 0;    // `Acquire()` had to build a new object
+    size_t recycled = 0;  // Released objects kept for reuse
+    size_t dropped = 0;   // Released objects destroyed because the pool was full or gone
+};
+
+// Calls `object.Reset()` before the object is reused, if `T` has such a member.
+template <typename T>
+void ResetPooled(T& object) {
+    if constexpr (requires { object.Reset(); }) {
+        object.Reset();
+    }
+}
+
+// Heap-allocated part of a pool: outlives the `ObjectPool` while any of its objects is in use.
+template <typename Slot>
+class PoolState {
+public:
+    explicit PoolState(size_t capacity) : capacity_(capacity) {
+    }
+
+    ~PoolState() {
+        for (Slot* slot : free_) {
+            delete slot;
+        }
+    }
+
+    // Returns a cached slot, or nullptr when the caller has to make a new one.
+    Slot* Take() {
+        if (free_.empty()) {
+            ++stats_.misses;
+            return nullptr;
+        }
+        ++stats_.hits;
+        Slot* slot = free_.back();
+        free_.pop_back();
+        return slot;
+    }
+
+    // Takes `slot` back, or destroys it when there is no room left. May destroy the state itself.
+    static void Give(PoolState* state, Slot* slot) {
+        --state->outstanding_;
+        if (!state->closed_ && state->free_.size() < state->capacity_) {
+            state->free_.push_back(slot);
+            ++state->stats_.recycled;
+            return;
+        }
+        ++state->stats_.dropped;
+        delete slot;
+        if (state->closed_ && state->outstanding_ == 0) {
+            delete state;
+        }
+    }
+
+    // Called by the owning pool's destructor.
+    static void Close(PoolState* state) {
+        state->closed_ = true;
+        state->Trim(0);
+        if (state->outstanding_ == 0) {
+            delete state;
+        }
+    }
+
+    void Trim(size_t size) {
+        while (free_.size() > size) {
+            delete free_.back();
+            free_.pop_back();
+        }
+    }
+
+    std::vector<Slot*> free_;
+    size_t capacity_;
+    size_t outstanding_ = 0;
+    bool closed_ = false;
+    PoolStats stats_;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// `SharedPtr` support
+
+// Control block that keeps its object alive between owners: `DeleteData` only resets it, and
+// `DeleteBlock` hands the whole block back to the pool.
+template <typename T>
+class PooledControlBlock : public ControlBlockBase {
+public:
+    explicit PooledControlBlock(PoolState<PooledControlBlock>* pool) : pool_(pool) {
+        strong_counter_ = 1;
+        weak_counter_ = 0;
+    }
+
+    T object_;
+    PoolState<PooledControlBlock>* pool_;
+
+    void DeleteData() override {
+        ResetPooled(object_);
+    }
+    void DeleteBlock() override {
+        PoolState<PooledControlBlock>::Give(pool_, this);
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// `IntrusivePtr` support
+
+template <typename T>
+class PoolHook {
+protected:
+    PoolHook() = default;
+    // A copy of a pooled object does not belong to the pool.
+    PoolHook(const PoolHook&) {
+    }
+    PoolHook& operator=(const PoolHook&) {
+        return *this;
+    }
+
+private:
+    PoolState<T>* pool_ = nullptr;
+
+    friend struct PoolDelete;
+    template <typename Y>
+    friend class ObjectPool;
+};
+
+// `Deleter` for `RefCounted` that returns objects to the pool they came from.
+struct PoolDelete {
+    template <typename T>
+    static void Destroy(T* object) {
+        PoolState<T>* pool = static_cast<PoolHook<T>*>(object)->pool_;
+        if (pool == nullptr) {
+            delete object;
+            return;
+        }
+        ResetPooled(*object);
+        PoolState<T>::Give(pool, object);
+    }
+};
+
+template <typename Derived, typename Counter = SimpleCounter>
+class PooledRefCounted : public RefCounted<Derived, Counter, PoolDelete>, public PoolHook<Derived> {
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Pool
+
+template <typename T>
+class ObjectPool {
+    static constexpr bool kIntrusive = std::is_base_of_v<PoolHook<T>, T>;
+    using Slot = std::conditional_t<kIntrusive, T, PooledControlBlock<T>>;
+
+public:
+    using Pointer = std::conditional_t<kIntrusive, IntrusivePtr<T>, SharedPtr<T>>;
+
+    // At most `capacity` released objects are kept for reuse.
+    explicit ObjectPool(size_t capacity) : state_(new PoolState<Slot>(capacity)) {
+    }
+
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool& operator=(const ObjectPool&) = delete;
+
+    ~ObjectPool() {
+        PoolState<Slot>::Close(state_);
+    }
+
+    Pointer Acquire() {
+        Slot* slot = state_->Take();
+        if (slot == nullptr) {
+            slot = Make();
+        }
+        ++state_->outstanding_;
+        if constexpr (kIntrusive) {
+            return IntrusivePtr<T>(slot);
+        } else {
+            slot->strong_counter_ = 1;
+            SharedPtr<T> owner;
+            owner.ptr_ = &slot->object_;
+            owner.cb_ = slot;
+            owner.AttachThis(owner.ptr_);
+            return owner;
+        }
+    }
+
+    // Builds objects up front so that the next `count` acquisitions hit.
+    void Reserve(size_t count) {
+        count = std::min(count, state_->capacity_);
+        while (state_->free_.size() < count) {
+            state_->free_.push_back(Make());
+        }
+    }
+
+    // Destroys cached objects beyond `size`.
+    void Trim(size_t size = 0) {
+        state_->Trim(size);
+    }
+
+    size_t Size() const {
+        return state_->free_.size();
+    }
+    size_t Capacity() const {
+        return state_->capacity_;
+    }
+    // Objects handed out and not yet returned.
+    size_t Outstanding() const {
+        return state_->outstanding_;
+    }
+    const PoolStats& Stats() const {
+        return state_->stats_;
+    }
+
+private:
+    Slot* Make() {
+        if constexpr (kIntrusive) {
+            T* object = new T();
+            object->pool_ = state_;
+            return object;
+        } else {
+            return new PooledControlBlock<T>(state_);
+        }
+    }
+
+    PoolState<Slot>* state_;
+};
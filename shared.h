@@ -1,11 +1,51 @@
 #pragma once
 
 #include "sw_fwd.h"  // Forward declaration
+#include "collector.h"
+#include "intrusive.h"
+#include "teardown.h"
 #include "weak.h"
+#include <cassert>
 #include <cstddef>  // std::nullptr_t
+#include <cstdint>
+#include <functional>
+#include <span>
 
 // https://en.cppreference.com/w/cpp/memory/shared_ptr
-class EnableBase {};
+// Points to the control block of the first `SharedPtr` that adopted the object. An object that
+// lives inside its block (`MakeShared`, pools, arenas) dies before the block does, so a plain
+// pointer is enough and costs no counter updates. An object allocated apart from its block may
+// outlive it, e.g. with a deleter that does not delete: it then holds a weak reference, which its
+// destructor gives back.
+class EnableBase {
+protected:
+    EnableBase() noexcept = default;
+    // Copies of an object are not owned by the original's owners.
+    EnableBase(const EnableBase&) noexcept {
+    }
+    EnableBase& operator=(const EnableBase&) noexcept {
+        return *this;
+    }
+    ~EnableBase() {
+        Detach();
+    }
+
+    ControlBlockBase* cb_this_ = nullptr;
+    // Whether `cb_this_` holds a weak reference.
+    bool weak_this_ = false;
+
+private:
+    void Detach() {
+        if (weak_this_ && --cb_this_->weak_counter_ == 0) {
+            cb_this_->DeleteBlock();
+        }
+        cb_this_ = nullptr;
+        weak_this_ = false;
+    }
+
+    template <typename Y>
+    friend class SharedPtr;
+};
 
 template <typename T>
 class EnableSharedFromThis : public EnableBase {
@@ -14,19 +54,42 @@ public:
     }
 
     SharedPtr<T> SharedFromThis() {
-        return weak_this_.Lock();
+        return Share<T>(static_cast<T*>(this));
     }
     SharedPtr<const T> SharedFromThis() const {
-        return weak_this_.Lock();
+        return Share<const T>(static_cast<const T*>(this));
     }
 
     WeakPtr<T> WeakFromThis() noexcept {
-        return weak_this_;
+        return Observe<T>(static_cast<T*>(this));
     }
     WeakPtr<const T> WeakFromThis() const noexcept {
-        return weak_this_;
+        return Observe<const T>(static_cast<const T*>(this));
+    }
+
+private:
+    // Increment-if-nonzero: an object that is not owned yet, or is being destroyed, has no owners
+    // left to share with.
+    template <typename Y>
+    SharedPtr<Y> Share(Y* self) const {
+        SharedPtr<Y> owner;
+        if (cb_this_ != nullptr && cb_this_->strong_counter_ != 0) {
+            cb_this_->strong_counter_++;
+            owner.ptr_ = self;
+            owner.cb_ = cb_this_;
+        }
+        return owner;
+    }
+    template <typename Y>
+    WeakPtr<Y> Observe(Y* self) const {
+        WeakPtr<Y> observer;
+        if (cb_this_ != nullptr) {
+            cb_this_->weak_counter_++;
+            observer.ptr_ = self;
+            observer.cb_ = cb_this_;
+        }
+        return observer;
     }
-    WeakPtr<T> weak_this_;
 };
 
 template <typename T>
@@ -35,8 +98,19 @@ class SharedPtr {
     friend class WeakPtr;
     template <typename Y>
     friend class SharedPtr;
+    template <typename Y>
+    friend class BorrowPtr;
+    template <typename Y>
+    friend class IntrusivePtr;
+    template <typename Derived, typename Counter, typename Deleter>
+    friend class RefCounted;
+    friend struct OwnerAccess;
 
 public:
+    // `T` may be an array of unknown bound, e.g. `SharedPtr<const std::byte[]>` for a buffer
+    // released by a custom deleter.
+    using element_type = std::remove_extent_t<T>;
+
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Constructors
 
@@ -50,28 +124,45 @@ public:
     }
     template <typename... Args>
     SharedPtr(NeedNewObject, Args&&... args) {
-        cb_ = new ControlBlockWithObject<T>(std::forward<Args>(args)...);
-        ptr_ = (dynamic_cast<ControlBlockWithObject<T>*>(cb_)->ptr_);
-        if constexpr (std::is_convertible_v<T, EnableBase>) {
-            (*ptr_).weak_this_ = std::move(WeakPtr<T>(*this));
+        if constexpr (kEmbedded<T>) {
+            Adopt(new T(std::forward<Args>(args)...));
+        } else {
+            auto* block = new ControlBlockWithObject<T>(std::forward<Args>(args)...);
+            cb_ = block;
+            ptr_ = block->ptr_;
+            AttachThis(ptr_);
         }
     }
 
-    explicit SharedPtr(T* ptr) : ptr_(ptr), cb_(new ControlBlockWithPointer<T>(ptr)) {
-        if constexpr (std::is_convertible_v<T, EnableBase>) {
-            (*ptr_).weak_this_ = std::move(WeakPtr<T>(*this));
-        }
+    explicit SharedPtr(T* ptr) {
+        Adopt(ptr);
     }
     template <typename Y>
-    explicit SharedPtr(Y* ptr) : ptr_(ptr), cb_(new ControlBlockWithPointer<Y>(ptr)) {
-        if constexpr (std::is_convertible_v<Y, EnableBase>) {
-            (*ptr_).weak_this_ = std::move(WeakPtr<T>(*this));
+    explicit SharedPtr(Y* ptr) {
+        Adopt(ptr);
+    }
+
+    // Owns `ptr` through `deleter`, which is called with it once the last owner goes. If the
+    // control block cannot be allocated, `ptr` is deleted right away.
+    // #4 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
+    template <typename Y, typename D>
+    SharedPtr(Y* ptr, D deleter) {
+        static_assert(std::is_convertible_v<Y*, element_type*>, "Inconvertible types");
+        try {
+            cb_ = new ControlBlockWithDeleter<Y, D>(ptr, std::move(deleter));
+        } catch (...) {
+            deleter(ptr);
+            throw;
         }
+        ptr_ = ptr;
+        AttachThis(ptr, true);
     }
 
+    // Shares `other`'s block. A pointer adopted from `new` that was not shared yet gets its block
+    // allocated here, even though `other` is const.
     SharedPtr(const SharedPtr& other) {
         ptr_ = other.ptr_;
-        cb_ = other.cb_;
+        cb_ = ShareBlock(other);
         if (cb_ != nullptr) {
             cb_->strong_counter_++;
         }
@@ -80,7 +171,7 @@ public:
     SharedPtr(const SharedPtr<Y>& other) {
         static_assert(std::is_convertible_v<Y*, T*>, "Inconvertible types");
         ptr_ = other.ptr_;
-        cb_ = other.cb_;
+        cb_ = ShareBlock(other);
         if (cb_ != nullptr) {
             cb_->strong_counter_++;
         }
@@ -91,11 +182,12 @@ public:
         other.ptr_ = nullptr;
         other.cb_ = nullptr;
     }
+    // A pointer that changes type can no longer be deleted through the stand-in block.
     template <typename Y>
     SharedPtr(SharedPtr<Y>&& other) {
         static_assert(std::is_convertible_v<Y*, T*>, "Inconvertible types");
         ptr_ = std::move(other.ptr_);
-        cb_ = std::move(other.cb_);
+        cb_ = other.Block();
         other.ptr_ = nullptr;
         other.cb_ = nullptr;
     }
@@ -103,14 +195,24 @@ public:
     // Aliasing constructor
     // #8 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
     template <typename Y>
-    SharedPtr(const SharedPtr<Y>& other, T* ptr) {
+    SharedPtr(const SharedPtr<Y>& other, element_type* ptr) {
         ptr_ = ptr;
-        cb_ = other.cb_;
+        cb_ = ShareBlock(other);
         if (cb_ != nullptr) {
             cb_->strong_counter_++;
         }
     }
 
+    // Aliasing constructor that takes over `other`'s reference instead of adding one
+    // #8 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
+    template <typename Y>
+    SharedPtr(SharedPtr<Y>&& other, element_type* ptr) {
+        ptr_ = ptr;
+        cb_ = other.Block();
+        other.ptr_ = nullptr;
+        other.cb_ = nullptr;
+    }
+
     // Promote `WeakPtr`
     // #11 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
     explicit SharedPtr(const WeakPtr<T>& other) {
@@ -136,13 +238,66 @@ public:
         }
     }
 
+    // Takes over a unique owner together with its deleter.
+    // #13 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
+    template <typename Y, typename D>
+    SharedPtr(UniquePtr<Y, D>&& other) {
+        static_assert(std::is_convertible_v<Y*, T*>, "Inconvertible types");
+        if constexpr (kEmbedded<Y>) {
+            static_assert(std::is_same_v<D, DefaultDeleter<Y>>,
+                          "Objects with an embedded control block use their own deleter");
+            Adopt(other.Release());
+        } else {
+            ptr_ = other.Get();
+            cb_ = nullptr;
+            if (ptr_ != nullptr) {
+                Y* object = other.Get();
+                cb_ = new ControlBlockWithDeleter<Y, D>(object, std::move(other.GetDeleter()));
+                other.Release();
+                AttachThis(object, true);
+            }
+        }
+    }
+    // Objects from `MakeUniqueShareable` already live in a control block: no allocation.
+    template <typename Y>
+    SharedPtr(UniquePtr<Y, ShareableDelete<Y>>&& other) {
+        static_assert(std::is_convertible_v<Y*, T*>, "Inconvertible types");
+        ptr_ = other.Get();
+        cb_ = nullptr;
+        if (ptr_ != nullptr) {
+            cb_ = other.GetDeleter().cb_;
+            Y* object = other.Release();
+            AttachThis(object);
+        }
+    }
+
+    // Shares the count embedded in a `SharedRefCounted` object: no allocation.
+    template <typename Y>
+    SharedPtr(const IntrusivePtr<Y>& other) {
+        static_assert(std::is_convertible_v<Y*, T*>, "Inconvertible types");
+        static_assert(kEmbedded<Y>, "Needs an object with an embedded control block");
+        ptr_ = other.Get();
+        cb_ = other.Get();
+        if (cb_ != nullptr) {
+            cb_->strong_counter_++;
+        }
+    }
+    template <typename Y>
+    SharedPtr(IntrusivePtr<Y>&& other) {
+        static_assert(std::is_convertible_v<Y*, T*>, "Inconvertible types");
+        static_assert(kEmbedded<Y>, "Needs an object with an embedded control block");
+        Y* object = other.Detach();
+        ptr_ = object;
+        cb_ = object;
+    }
+
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // `operator=`-s
 
     SharedPtr& operator=(const SharedPtr& other) {
         Reset();
         ptr_ = std::move(other.ptr_);
-        cb_ = std::move(other.cb_);
+        cb_ = ShareBlock(other);
         if (cb_ != nullptr) {
             cb_->strong_counter_++;
         }
@@ -153,7 +308,7 @@ public:
         static_assert(std::is_convertible_v<Y*, T*>, "Inconvertible types");
         Reset();
         ptr_ = other.ptr_;
-        cb_ = other.cb_;
+        cb_ = ShareBlock(other);
         if (cb_ != nullptr) {
             cb_->strong_counter_++;
         }
@@ -172,7 +327,7 @@ public:
         static_assert(std::is_convertible_v<Y*, T*>, "Inconvertible types");
         Reset();
         ptr_ = std::move(other.ptr_);
-        cb_ = std::move(other.cb_);
+        cb_ = other.Block();
         other.ptr_ = nullptr;
         other.cb_ = nullptr;
         return *this;
@@ -189,41 +344,14 @@ public:
     // Modifiers
 
     void Reset() {
-        if (cb_ != nullptr) {
-            cb_->strong_counter_--;
-            if (cb_->strong_counter_ == 0) {
-                cb_->strong_counter_++;
-                if constexpr (std::is_convertible_v<T, EnableBase>) {
-                    (*ptr_).weak_this_.Reset();
-                }
-                cb_->strong_counter_--;
-                cb_->DeleteData();
-            }
-            if (cb_->strong_counter_ == 0 && cb_->weak_counter_ == 0) {
-                delete cb_;
-            }
-        }
+        Drop();
         ptr_ = nullptr;
         cb_ = nullptr;
     }
     template <typename Y>
     void Reset(Y* ptr) {
-        if (cb_ != nullptr) {
-            cb_->strong_counter_--;
-            if (cb_->strong_counter_ == 0) {
-                cb_->strong_counter_++;
-                if constexpr (std::is_convertible_v<T, EnableBase>) {
-                    (*ptr_).weak_this_.Reset();
-                }
-                cb_->strong_counter_--;
-                cb_->DeleteData();
-            }
-            if (cb_->strong_counter_ == 0 && cb_->weak_counter_ == 0) {
-                delete cb_;
-            }
-        }
-        ptr_ = ptr;
-        cb_ = new ControlBlockWithPointer<Y>(ptr);
+        Drop();
+        Adopt(ptr);
     }
     void Swap(SharedPtr& other) {
         std::swap(ptr_, other.ptr_);
@@ -233,37 +361,418 @@ public:
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Observers
 
-    T* Get() const {
+    element_type* Get() const {
         return ptr_;
     }
-    T& operator*() const {
+    element_type& operator*() const {
         return *ptr_;
     }
-    T* operator->() const {
+    element_type* operator->() const {
         return Get();
     }
+    element_type& operator[](ptrdiff_t index) const
+        requires std::is_array_v<T>
+    {
+        return ptr_[index];
+    }
     size_t UseCount() const {
         if (cb_ == nullptr) {
             return 0;
         }
-        return cb_->strong_counter_;
+        return Deferred(cb_) ? 1 : cb_->strong_counter_;
+    }
+    // Whether any `WeakPtr` observes the object.
+    bool Observed() const {
+        return cb_ != nullptr && !Deferred(cb_) && cb_->weak_counter_ != 0;
     }
     explicit operator bool() const {
         return Get() != nullptr;
     }
 
+    // Ordering by control block instead of by stored pointer: aliased pointers sharing an owner
+    // are equivalent, and so are a `SharedPtr` and the `WeakPtr`s observing it. Never allocates,
+    // see `Owner()`.
+    template <typename Y>
+    bool OwnerBefore(const SharedPtr<Y>& other) const {
+        return std::less<const void*>{}(Owner(), other.Owner());
+    }
+    template <typename Y>
+    bool OwnerBefore(const WeakPtr<Y>& other) const {
+        return std::less<const void*>{}(Owner(), other.cb_);
+    }
+
 private:
-    T* ptr_;
-    ControlBlockBase* cb_;
+    template <typename Y>
+    friend void ShareN(const SharedPtr<Y>& ptr, std::span<SharedPtr<Y>> out);
+    template <typename Y>
+    friend void ReleaseAll(std::span<SharedPtr<Y>> ptrs);
+    template <typename Y>
+    friend SharedPtr<Y> FromStd(std::shared_ptr<Y> ptr);
+
+    template <typename Y>
+    friend class EnableSharedFromThis;
+    template <typename Y>
+    friend class ObjectPool;
+    template <typename Y>
+    friend class SlotMap;
+    friend class CycleTracer;
+    template <typename Y, size_t Bits>
+    friend class TaggedSharedPtr;
+    template <typename Y, typename Tag>
+    friend class OffsetSharedPtr;
+    friend class SharedBuffer;
+    template <typename Y, typename E, typename... Args>
+    friend SharedPtr<Y> MakeSharedWithTrailing(size_t count, Args&&... args);
+
+    // Destroyed through the per-thread queue, see `IterativeTeardown`.
+    // Candidates for the cycle collector whenever they lose a reference, see `Collectable`.
+    // Both are pointer conversions, which do not need `T` to be complete: plain types may be
+    // incomplete where their owners are released, but these two must be complete there.
+    static constexpr bool kIterative = std::is_convertible_v<T*, const IterativeTeardown*>;
+    static constexpr bool kCollectable = std::is_convertible_v<T*, const Collectable*>;
+
+    // Objects that are their own control block, see `SharedRefCounted`.
+    template <typename Y>
+    static constexpr bool kEmbedded = std::is_convertible_v<Y*, ControlBlockBase*>;
+
+    // Takes ownership of a raw pointer. Objects with an embedded block gain one more owner. For
+    // plain objects the block is allocated on first share: a pointer that only ever has this one
+    // owner is deleted through its type's `DeferredControlBlock`. Objects that can share
+    // themselves need the block at once.
+    template <typename Y>
+    void Adopt(Y* ptr) {
+        static_assert(!std::is_array_v<T>, "Arrays are released by a deleter: pass one");
+        ptr_ = ptr;
+        if constexpr (kEmbedded<Y>) {
+            cb_ = ptr;
+            if (cb_ != nullptr) {
+                cb_->strong_counter_++;
+            }
+            AttachThis(ptr);
+        } else if constexpr (std::is_same_v<Y, T> && !std::is_convertible_v<T*, EnableBase*> &&
+                             !kCollectable) {
+            cb_ = &deferred_control_block<std::remove_cv_t<T>>;
+        } else {
+            cb_ = new ControlBlockWithPointer<Y>(ptr);
+            AttachThis(ptr, true);
+        }
+    }
+
+    // Lets an `EnableSharedFromThis` object find the block that owns it. `separate` objects are
+    // allocated apart from the block and may outlive it, so they hold a weak reference. As with
+    // `std::enable_shared_from_this`, an object that still has owners keeps them.
+    template <typename Y>
+    void AttachThis(Y* ptr, bool separate = false) {
+        if constexpr (std::is_convertible_v<Y*, EnableBase*>) {
+            auto* self = static_cast<EnableBase*>(ptr);
+            if (self != nullptr &&
+                (self->cb_this_ == nullptr || self->cb_this_->strong_counter_ == 0)) {
+                self->Detach();
+                self->cb_this_ = cb_;
+                if (separate) {
+                    cb_->weak_counter_++;
+                    self->weak_this_ = true;
+                }
+            }
+        }
+        if constexpr (std::is_convertible_v<Y*, const Collectable*>) {
+            if (ptr != nullptr) {
+                const_cast<Collectable*>(static_cast<const Collectable*>(ptr))->block_ = cb_;
+            }
+        }
+    }
+
+    static bool Deferred(const ControlBlockBase* cb) {
+        return cb != nullptr && cb->strong_counter_ == DeferredControlBlock::kMark;
+    }
+    static void (*DeferredDelete(const ControlBlockBase* cb))(void*) {
+        return static_cast<const DeferredControlBlock*>(cb)->destroy_;
+    }
+    static void* Erased(element_type* ptr) {
+        return const_cast<std::remove_cv_t<element_type>*>(ptr);
+    }
+
+    // Identifies the owner without allocating: the block, or the object itself while this is its
+    // only owner. Nothing else can name that owner yet, and no live block shares the object's
+    // address. Sharing the pointer later gives it a block, and with it a new identity.
+    const void* Owner() const {
+        return Deferred(cb_) ? static_cast<const void*>(ptr_) : cb_;
+    }
+
+    // Returns the control block to share, allocating it if this pointer has not been shared yet.
+    // Only sharing calls this: observers go through `Owner()` instead.
+    ControlBlockBase* Block() {
+        return Materialize(cb_, Erased(ptr_));
+    }
+    // Copying shares ownership, so a const pointer adopted from `new` gets its block here too and
+    // may throw `std::bad_alloc`, exactly as the non-const copy does. This is why `cb_` is
+    // mutable. Like every other use of the counts, it must not race with another thread.
+    template <typename Y>
+    static ControlBlockBase* ShareBlock(const SharedPtr<Y>& other) {
+        return const_cast<SharedPtr<Y>&>(other).Block();
+    }
+    // Gives a pointer that was not shared yet its block, in place; `BorrowPtr::Promote()` also
+    // reaches the owner's `cb_` this way.
+    static ControlBlockBase* Materialize(ControlBlockBase*& cb, void* object) {
+        if (Deferred(cb)) {
+            cb = new ControlBlockWithDeleter<void, void (*)(void*)>(object, DeferredDelete(cb));
+        }
+        return cb;
+    }
+
+    // Out of line: keeps the common path of `Reset()` small.
+    [[gnu::noinline]] static void DeleteOwned(element_type* ptr, void (*destroy)(void*)) {
+        if constexpr (kIterative) {
+            PostponeTeardown(Erased(ptr), destroy);
+        } else {
+            destroy(Erased(ptr));
+        }
+    }
+
+    // Gives up this pointer's reference.
+    void Drop() {
+#ifndef NDEBUG
+        assert(!BorrowCounts::Any(&cb_) && "SharedPtr reset or moved away while borrowed");
+#endif
+        if (Deferred(cb_)) {
+            DeleteOwned(ptr_, DeferredDelete(cb_));
+        } else if (cb_ != nullptr) {
+            if constexpr (kCollectable) {
+                if (cb_->strong_counter_ > 1 && ptr_ != nullptr && !CycleCollector::Destroyed()) {
+                    cb_->strong_counter_--;
+                    auto* object = static_cast<const Collectable*>(ptr_);
+                    ThreadCycleCollector().PossibleRoot(cb_, const_cast<Collectable*>(object));
+                    return;
+                }
+            }
+            Release(cb_, 1);
+        }
+    }
+
+    // Drops `count` strong references to `cb` at once, destroying the object and the block
+    // when they were the last ones.
+    static void Release(ControlBlockBase* cb, size_t count) {
+        cb->strong_counter_ -= count;
+        if (cb->strong_counter_ != 0) {
+            return;
+        }
+#ifndef NDEBUG
+        assert(!BorrowCounts::Any(cb) && "BorrowPtr outlived the last SharedPtr");
+#endif
+        // The object's destructor may drop weak references to its own block, and a postponed
+        // destruction must not lose the block to the last `WeakPtr` in the meantime.
+        cb->weak_counter_++;
+        if constexpr (kIterative) {
+            PostponeTeardown(cb, &Destroy);
+        } else {
+            Destroy(cb);
+        }
+    }
+    static void Destroy(void* block) {
+        auto* cb = static_cast<ControlBlockBase*>(block);
+        cb->DeleteData();
+        if (--cb->weak_counter_ == 0) {
+            cb->DeleteBlock();
+        }
+    }
+
+    element_type* ptr_;
+    // Materialized by `ShareBlock()` on the first share, even through a const pointer.
+    mutable ControlBlockBase* cb_;
 };
 
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Embedded control block
+
+// Counter policy for `RefCounted` that makes the object its own `SharedPtr` control block: the
+// intrusive count is the strong count, so `SharedPtr` and `IntrusivePtr` convert into each other
+// without allocating and report the same `UseCount()`.
+//
+// The object is destroyed with its block, once no `WeakPtr` observes it either. `WeakPtr`s would
+// keep the whole object alive, so debug builds reject them; use `IntrusiveWeakPtr` instead.
+struct SharedCount {};
+
+template <typename Derived, typename Deleter>
+class RefCounted<Derived, SharedCount, Deleter> : public ControlBlockBase {
+public:
+    RefCounted() {
+        strong_counter_ = 0;
+        weak_counter_ = 0;
+    }
+    // A copy of an object is a new object: it starts without references.
+    RefCounted(const RefCounted&) : RefCounted() {
+    }
+    RefCounted& operator=(const RefCounted&) {
+        return *this;
+    }
+
+    void IncRef() {
+        strong_counter_++;
+    }
+    // Only the last release leaves the inlined path; `Release` then has nothing left to subtract.
+    void DecRef() {
+        if (--strong_counter_ == 0) {
+            SharedPtr<Derived>::Release(this, 0);
+        }
+    }
+    size_t RefCount() const {
+        return strong_counter_;
+    }
+
+    void DeleteData() override {
+        // `Release` holds one weak reference of its own while calling this.
+        assert(weak_counter_ == 1 && "WeakPtr to an object with an embedded control block");
+    }
+    void DeleteBlock() override {
+        Deleter::Destroy(static_cast<Derived*>(this));
+    }
+};
+
+template <typename Derived, typename D = DefaultDelete>
+using SharedRefCounted = RefCounted<Derived, SharedCount, D>;
+
 template <typename T, typename U>
 inline bool operator==(const SharedPtr<T>& left, const SharedPtr<U>& right) {
     return left.Get() == right.Get();
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Casts
+// https://en.cppreference.com/w/cpp/memory/shared_ptr/pointer_cast
+// The rvalue overloads move the reference into the result, so a cast costs no counter updates.
+
+template <typename T, typename U>
+SharedPtr<T> StaticPointerCast(const SharedPtr<U>& other) {
+    return SharedPtr<T>(other, static_cast<T*>(other.Get()));
+}
+template <typename T, typename U>
+SharedPtr<T> StaticPointerCast(SharedPtr<U>&& other) {
+    T* ptr = static_cast<T*>(other.Get());
+    return SharedPtr<T>(std::move(other), ptr);
+}
+
+// On failure the result is empty and an rvalue argument keeps its reference.
+template <typename T, typename U>
+SharedPtr<T> DynamicPointerCast(const SharedPtr<U>& other) {
+    if (T* ptr = dynamic_cast<T*>(other.Get())) {
+        return SharedPtr<T>(other, ptr);
+    }
+    return SharedPtr<T>();
+}
+template <typename T, typename U>
+SharedPtr<T> DynamicPointerCast(SharedPtr<U>&& other) {
+    if (T* ptr = dynamic_cast<T*>(other.Get())) {
+        return SharedPtr<T>(std::move(other), ptr);
+    }
+    return SharedPtr<T>();
+}
+
+template <typename T, typename U>
+SharedPtr<T> ConstPointerCast(const SharedPtr<U>& other) {
+    return SharedPtr<T>(other, const_cast<T*>(other.Get()));
+}
+template <typename T, typename U>
+SharedPtr<T> ConstPointerCast(SharedPtr<U>&& other) {
+    T* ptr = const_cast<T*>(other.Get());
+    return SharedPtr<T>(std::move(other), ptr);
+}
+
+template <typename T, typename U>
+SharedPtr<T> ReinterpretPointerCast(const SharedPtr<U>& other) {
+    return SharedPtr<T>(other, reinterpret_cast<T*>(other.Get()));
+}
+template <typename T, typename U>
+SharedPtr<T> ReinterpretPointerCast(SharedPtr<U>&& other) {
+    T* ptr = reinterpret_cast<T*>(other.Get());
+    return SharedPtr<T>(std::move(other), ptr);
+}
+
+template <typename T>
+struct std::hash<SharedPtr<T>> {
+    size_t operator()(const SharedPtr<T>& ptr) const {
+        return std::hash<T*>{}(ptr.Get());
+    }
+};
+
 // Allocate memory only once
 template <typename T, typename... Args>
 SharedPtr<T> MakeShared(Args&&... args) {
     return SharedPtr<T>(NeedNewObject{}, std::forward<Args>(args)...);
 }
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// Batch operations
+
+// Empties every element of `ptrs`. Runs of the same owner are counted in registers, and runs are
+// merged per control block in a small direct-mapped table, so repeated owners receive one net
+// update. Each block is prefetched when it enters the table, well before its counter is touched.
+template <typename T>
+void ReleaseAll(std::span<SharedPtr<T>> ptrs) {
+    struct Pending {
+        ControlBlockBase* cb = nullptr;
+        size_t count = 0;
+    };
+    if constexpr (SharedPtr<T>::kCollectable) {
+        // Every survivor has to be offered to the cycle collector.
+        for (auto& slot : ptrs) {
+            slot.Reset();
+        }
+        return;
+    }
+    constexpr size_t kSlots = 16;
+    Pending pending[kSlots];
+    auto flush = [&pending](Pending run) {
+        if (run.cb == nullptr) {
+            return;
+        }
+        auto& entry = pending[(reinterpret_cast<uintptr_t>(run.cb) >> 4) % kSlots];
+        if (entry.cb == run.cb) {
+            entry.count += run.count;
+            return;
+        }
+        if (entry.cb != nullptr) {
+            SharedPtr<T>::Release(entry.cb, entry.count);
+        }
+        PrefetchControlBlock(run.cb);
+        entry = run;
+    };
+
+    Pending run;
+    for (auto& slot : ptrs) {
+        if (SharedPtr<T>::Deferred(slot.cb_)) {
+            slot.Reset();
+            continue;
+        }
+        if (slot.cb_ == run.cb) {
+            ++run.count;
+        } else {
+            flush(run);
+            run = {slot.cb_, 1};
+        }
+        slot.ptr_ = nullptr;
+        slot.cb_ = nullptr;
+    }
+    flush(run);
+    for (auto& entry : pending) {
+        if (entry.cb != nullptr) {
+            SharedPtr<T>::Release(entry.cb, entry.count);
+        }
+    }
+}
+
+// Makes every element of `out` share ownership with `ptr` using a single counter update.
+// Previous contents of `out` are released.
+template <typename T>
+void ShareN(const SharedPtr<T>& ptr, std::span<SharedPtr<T>> out) {
+    ControlBlockBase* cb = SharedPtr<T>::ShareBlock(ptr);
+    auto* object = ptr.ptr_;
+    if (cb != nullptr) {
+        cb->strong_counter_ += out.size();
+    }
+    for (auto& slot : out) {
+        SharedPtr<T> old;
+        old.Swap(slot);
+        slot.ptr_ = object;
+        slot.cb_ = cb;
+    }
+}
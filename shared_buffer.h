@@ -0,0 +1,229 @@
+#pragma once
+
+#include "sw_fwd.h"  // Forward declaration
+#include "shared.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <span>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+// Reference-counted byte buffers in the spirit of folly's IOBuf. The control block and the bytes
+// are one allocation, and a `SharedBuffer` is an aliased `SharedPtr` to a range of those bytes:
+// `Slice` makes a view of a sub-range that shares the block, without copying. Appending writes
+// into the free space after the view when no one else holds the block, and copies otherwise.
+// `BufferChain` strings buffers together for scatter/gather I/O.
+
+// Control block with the bytes right behind it.
+class BufferBlock : public ControlBlockBase {
+public:
+    static BufferBlock* Make(size_t capacity) {
+        void* memory = ::operator new(sizeof(BufferBlock) + capacity);
+        return new (memory) BufferBlock(capacity);
+    }
+
+    std::byte* Bytes() {
+        return reinterpret_cast<std::byte*>(this + 1);
+    }
+    size_t Capacity() const {
+        return capacity_;
+    }
+
+    void DeleteData() override {
+    }
+    void DeleteBlock() override {
+        this->~BufferBlock();
+        ::operator delete(this);
+    }
+
+private:
+    explicit BufferBlock(size_t capacity) : capacity_(capacity) {
+        strong_counter_ = 1;
+        weak_counter_ = 0;
+    }
+
+    size_t capacity_;
+};
+
+class SharedBuffer {
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    SharedBuffer() = default;
+
+    // Empty buffer with room for `capacity` bytes.
+    static SharedBuffer Allocate(size_t capacity) {
+        BufferBlock* block = BufferBlock::Make(capacity);
+        SharedBuffer buffer;
+        buffer.data_.ptr_ = block->Bytes();
+        buffer.data_.cb_ = block;
+        return buffer;
+    }
+    static SharedBuffer Copy(std::span<const std::byte> bytes, size_t capacity = 0) {
+        SharedBuffer buffer = Allocate(std::max(capacity, bytes.size()));
+        buffer.Append(bytes);
+        return buffer;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Views
+
+    // The `length` bytes at `offset`, sharing this buffer's block.
+    SharedBuffer Slice(size_t offset, size_t length) const {
+        if (offset > size_ || length > size_ - offset) {
+            throw std::out_of_range("Slice is outside of the buffer");
+        }
+        SharedBuffer slice;
+        slice.data_ = SharedPtr<std::byte[]>(data_, data_.Get() + offset);
+        slice.size_ = length;
+        return slice;
+    }
+
+    // Owning pointer to the bytes, e.g. to hand them to an API that takes a `SharedPtr`.
+    SharedPtr<const std::byte[]> Share() const {
+        return data_;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    // Writes `bytes` after the view: in place when the block is not shared and has room, into a
+    // new block otherwise. Other views never see the change.
+    void Append(std::span<const std::byte> bytes) {
+        if (bytes.empty()) {
+            return;
+        }
+        if (TailRoom() < bytes.size() || !IsUnique()) {
+            Reserve(std::max(size_ + bytes.size(), 2 * size_));
+        }
+        std::memcpy(data_.Get() + size_, bytes.data(), bytes.size());
+        size_ += bytes.size();
+    }
+
+    // Makes sure appending `capacity - Size()` bytes needs no allocation. Copies the view into a
+    // block of its own if the current block is shared or too small.
+    void Reserve(size_t capacity) {
+        if (IsUnique() && size_ + TailRoom() >= capacity) {
+            return;
+        }
+        SharedBuffer fresh = Allocate(std::max(capacity, size_));
+        if (size_ != 0) {
+            std::memcpy(fresh.data_.Get(), data_.Get(), size_);
+        }
+        fresh.size_ = size_;
+        *this = std::move(fresh);
+    }
+
+    void Clear() {
+        data_.Reset();
+        size_ = 0;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    const std::byte* Data() const {
+        return data_.Get();
+    }
+    std::span<const std::byte> Bytes() const {
+        return {data_.Get(), size_};
+    }
+    // Writable only while nothing else shares or observes the block.
+    std::span<std::byte> MutableBytes() {
+        assert(IsUnique() && "Writing into a shared buffer");
+        return {data_.Get(), size_};
+    }
+    size_t Size() const {
+        return size_;
+    }
+    bool Empty() const {
+        return size_ == 0;
+    }
+
+    // Free bytes of the block after the end of this view.
+    size_t TailRoom() const {
+        if (data_.cb_ == nullptr) {
+            return 0;
+        }
+        auto* block = static_cast<BufferBlock*>(data_.cb_);
+        return block->Capacity() - static_cast<size_t>(data_.Get() + size_ - block->Bytes());
+    }
+    // Blocks are never deferred, so the counter is read directly.
+    size_t UseCount() const {
+        return data_.cb_ == nullptr ? 0 : data_.cb_->strong_counter_;
+    }
+    // Nothing else owns the block, and no `WeakPtr` taken from `Share()` can lock it later: only
+    // then may the bytes change in place, as for `CowPtr`.
+    bool IsUnique() const {
+        return UseCount() == 1 && !data_.Observed();
+    }
+
+private:
+    SharedPtr<std::byte[]> data_;
+    size_t size_ = 0;
+};
+
+// Sequence of buffers handled as one payload: appending a buffer links it without copying.
+class BufferChain {
+public:
+    void Append(SharedBuffer buffer) {
+        if (!buffer.Empty()) {
+            size_ += buffer.Size();
+            buffers_.push_back(std::move(buffer));
+        }
+    }
+
+    // The `length` bytes at `offset`, as slices of the buffers they span.
+    BufferChain Slice(size_t offset, size_t length) const {
+        if (offset > size_ || length > size_ - offset) {
+            throw std::out_of_range("Slice is outside of the chain");
+        }
+        BufferChain slice;
+        for (const SharedBuffer& buffer : buffers_) {
+            if (length == 0) {
+                break;
+            }
+            if (offset >= buffer.Size()) {
+                offset -= buffer.Size();
+                continue;
+            }
+            size_t take = std::min(length, buffer.Size() - offset);
+            slice.Append(buffer.Slice(offset, take));
+            offset = 0;
+            length -= take;
+        }
+        return slice;
+    }
+
+    // All bytes in one buffer. Free when the chain is a single buffer.
+    SharedBuffer Coalesce() const {
+        if (buffers_.size() == 1) {
+            return buffers_.front();
+        }
+        SharedBuffer result = SharedBuffer::Allocate(size_);
+        for (const SharedBuffer& buffer : buffers_) {
+            result.Append(buffer.Bytes());
+        }
+        return result;
+    }
+
+    std::span<const SharedBuffer> Buffers() const {
+        return buffers_;
+    }
+    size_t Size() const {
+        return size_;
+    }
+    bool Empty() const {
+        return size_ == 0;
+    }
+
+private:
+    std::vector<SharedBuffer> buffers_;
+    size_t size_ = 0;
+};
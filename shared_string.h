@@ -0,0 +1,232 @@
+#pragma once
+
+#include "sw_fwd.h"  // Forward declaration
+
+#include <compare>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <string>
+#include <string_view>
+#include <utility>
+
+// Immutable strings for keys that are copied a lot, e.g. between cache layers. A long string is
+// one allocation holding a control block, the length, the hash and the characters, so a copy only
+// bumps a counter and hashing it again is free. Strings of up to 15 characters are stored inline
+// and copied by value, without any counter.
+//
+// The hash is `std::hash<std::string_view>` of the characters, so `SharedStringHash` together with
+// `std::equal_to<>` lets hash maps keyed by `SharedString` be searched with plain string views.
+// Constructors are explicit, since a long string allocates. Like `SharedPtr`, copies of one string
+// must stay within a thread.
+
+// Control block with the characters right behind it. Only strong references exist.
+class StringBlock : public ControlBlockBase {
+public:
+    static StringBlock* Make(std::string_view text) {
+        void* memory = ::operator new(sizeof(StringBlock) + text.size() + 1);
+        auto* block = new (memory) StringBlock(text.size(), std::hash<std::string_view>{}(text));
+        std::memcpy(block->Chars(), text.data(), text.size());
+        block->Chars()[text.size()] = '\0';
+        return block;
+    }
+
+    char* Chars() {
+        return reinterpret_cast<char*>(this + 1);
+    }
+    size_t Size() const {
+        return size_;
+    }
+    size_t Hash() const {
+        return hash_;
+    }
+
+    void DeleteData() override {
+    }
+    void DeleteBlock() override {
+        this->~StringBlock();
+        ::operator delete(this);
+    }
+
+private:
+    StringBlock(size_t size, size_t hash) : size_(size), hash_(hash) {
+        strong_counter_ = 1;
+        weak_counter_ = 0;
+    }
+
+    size_t size_;
+    size_t hash_;
+};
+
+class SharedString {
+public:
+    static constexpr size_t kInlineCapacity = 15;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    SharedString() {
+        bytes_[kTag] = kInlineCapacity;
+    }
+    explicit SharedString(std::string_view text) {
+        if (text.size() <= kInlineCapacity) {
+            std::memcpy(bytes_, text.data(), text.size());
+            bytes_[text.size()] = '\0';
+            bytes_[kTag] = static_cast<char>(kInlineCapacity - text.size());
+        } else {
+            StringBlock* block = StringBlock::Make(text);
+            std::memcpy(bytes_, &block, sizeof(block));
+            bytes_[kTag] = kOnHeap;
+        }
+    }
+    explicit SharedString(const char* text) : SharedString(std::string_view(text)) {
+    }
+    explicit SharedString(const std::string& text) : SharedString(std::string_view(text)) {
+    }
+
+    SharedString(const SharedString& other) {
+        std::memcpy(bytes_, other.bytes_, sizeof(bytes_));
+        if (StringBlock* block = Block()) {
+            block->strong_counter_++;
+        }
+    }
+    SharedString(SharedString&& other) {
+        std::memcpy(bytes_, other.bytes_, sizeof(bytes_));
+        other.bytes_[0] = '\0';
+        other.bytes_[kTag] = kInlineCapacity;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    SharedString& operator=(const SharedString& other) {
+        SharedString(other).Swap(*this);
+        return *this;
+    }
+    SharedString& operator=(SharedString&& other) {
+        SharedString(std::move(other)).Swap(*this);
+        return *this;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~SharedString() {
+        if (StringBlock* block = Block()) {
+            if (--block->strong_counter_ == 0) {
+                block->DeleteBlock();
+            }
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    void Swap(SharedString& other) {
+        char bytes[sizeof(bytes_)];
+        std::memcpy(bytes, bytes_, sizeof(bytes_));
+        std::memcpy(bytes_, other.bytes_, sizeof(bytes_));
+        std::memcpy(other.bytes_, bytes, sizeof(bytes_));
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    // Null-terminated.
+    const char* Data() const {
+        StringBlock* block = Block();
+        return block == nullptr ? bytes_ : block->Chars();
+    }
+    size_t Size() const {
+        if (StringBlock* block = Block()) {
+            return block->Size();
+        }
+        return kInlineCapacity - static_cast<size_t>(bytes_[kTag]);
+    }
+    bool Empty() const {
+        return Size() == 0;
+    }
+    std::string_view View() const {
+        return {Data(), Size()};
+    }
+    operator std::string_view() const {
+        return View();
+    }
+
+    // Cached for heap strings; inline ones are short enough to hash on demand.
+    size_t Hash() const {
+        StringBlock* block = Block();
+        return block == nullptr ? std::hash<std::string_view>{}(View()) : block->Hash();
+    }
+
+    bool IsInline() const {
+        return bytes_[kTag] != kOnHeap;
+    }
+    // Owners of the characters; inline strings have no shared storage.
+    size_t UseCount() const {
+        StringBlock* block = Block();
+        return block == nullptr ? 0 : block->strong_counter_;
+    }
+
+    // Same storage or, failing that, same hash and characters.
+    friend bool operator==(const SharedString& left, const SharedString& right) {
+        StringBlock* first = left.Block();
+        StringBlock* second = right.Block();
+        if (first != nullptr && second != nullptr) {
+            if (first == second) {
+                return true;
+            }
+            if (first->Hash() != second->Hash()) {
+                return false;
+            }
+        }
+        return left.View() == right.View();
+    }
+    friend std::strong_ordering operator<=>(const SharedString& left, const SharedString& right) {
+        return left.View() <=> right.View();
+    }
+    friend bool operator==(const SharedString& left, std::string_view right) {
+        return left.View() == right;
+    }
+    friend std::strong_ordering operator<=>(const SharedString& left, std::string_view right) {
+        return left.View() <=> right;
+    }
+
+private:
+    // The last byte tags the representation: for inline strings it holds the unused capacity, so
+    // that it doubles as the terminator of a full 15-character string.
+    static constexpr size_t kTag = kInlineCapacity;
+    static constexpr char kOnHeap = -1;
+
+    StringBlock* Block() const {
+        if (IsInline()) {
+            return nullptr;
+        }
+        StringBlock* block;
+        std::memcpy(&block, bytes_, sizeof(block));
+        return block;
+    }
+
+    alignas(StringBlock*) char bytes_[kInlineCapacity + 1] = {};
+};
+
+// Transparent hasher: with `std::equal_to<>` it lets `std::unordered_map` look up
+// `SharedString` keys by `std::string_view` without making a key first.
+struct SharedStringHash {
+    using is_transparent = void;
+
+    size_t operator()(const SharedString& text) const {
+        return text.Hash();
+    }
+    size_t operator()(std::string_view text) const {
+        return std::hash<std::string_view>{}(text);
+    }
+};
+
+template <>
+struct std::hash<SharedString> {
+    size_t operator()(const SharedString& text) const {
+        return text.Hash();
+    }
+};
@@ -0,0 +1,301 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>  // std::nullptr_t
+#include <cstdint>
+#include <new>
+#include <string>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Shared ownership of an object that lives in a POSIX shared memory segment and is used by
+// several processes. `MakeShmShared<T>(name, args...)` creates the segment and the object,
+// `OpenShmShared<T>(name)` attaches to it from any process, and the segment is destroyed and
+// unlinked when the last process drops its last reference.
+//
+// The segment starts with a header holding an atomic count of holder processes and a registry of
+// their pids. Within a process, copies of a `ShmSharedPtr` only touch a process-local atomic
+// counter; the process is one holder in the segment until that counter drops to zero. A process
+// that dies without detaching leaves its pid behind, and whoever attaches or detaches next reaps
+// it, so crashed workers do not keep the segment alive forever.
+//
+// The object is found through its offset in the segment, so every process may map it at a
+// different address. For the same reason `T` must not hold pointers into process-local memory.
+// A forked child inherits the parent's pointers but not its registry slot: it should call
+// `OpenShmShared` itself and leave with `_exit`.
+
+struct ShmHeader {
+    static constexpr uint64_t kMagic = 0x5348'4d50'5452'0001;  // "SHMPTR" v1
+    static constexpr size_t kMaxHolders = 64;
+
+    std::atomic<uint64_t> magic;  // Published last, once the object is constructed
+    std::atomic<uint32_t> holders;
+    uint32_t object_offset;
+    uint64_t object_size;
+    std::atomic<pid_t> registry[kMaxHolders];  // 0 marks a free slot
+};
+
+// Process-local side of a mapped segment, shared by all copies of a `ShmSharedPtr` in it.
+class ShmAttachment {
+public:
+    ShmAttachment(std::string name, ShmHeader* header, size_t size, size_t slot,
+                  void (*destroy)(void*))
+        : name_(std::move(name)), header_(header), size_(size), slot_(slot), destroy_(destroy) {
+    }
+
+    void IncRef() {
+        refs_.fetch_add(1, std::memory_order_relaxed);
+    }
+    void DecRef() {
+        if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            Detach();
+        }
+    }
+
+    ShmHeader* Header() const {
+        return header_;
+    }
+
+    // Frees the registry slots of dead processes. Returns true if that dropped the last holder,
+    // which makes the caller responsible for the segment.
+    static bool Reap(ShmHeader* header) {
+        for (auto& entry : header->registry) {
+            pid_t pid = entry.load(std::memory_order_acquire);
+            if (pid == 0 || pid == getpid() || kill(pid, 0) == 0 || errno != ESRCH) {
+                continue;
+            }
+            if (entry.compare_exchange_strong(pid, 0, std::memory_order_acq_rel) &&
+                header->holders.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Runs the destructor of the object and removes the segment. Only the last holder calls it.
+    static void Destroy(const std::string& name, ShmHeader* header, void (*destroy)(void*)) {
+        destroy(reinterpret_cast<char*>(header) + header->object_offset);
+        shm_unlink(name.c_str());
+    }
+
+private:
+    void Detach() {
+        header_->registry[slot_].store(0, std::memory_order_release);
+        bool last = header_->holders.fetch_sub(1, std::memory_order_acq_rel) == 1 || Reap(header_);
+        if (last) {
+            Destroy(name_, header_, destroy_);
+        }
+        munmap(header_, size_);
+        delete this;
+    }
+
+    std::string name_;
+    ShmHeader* header_;
+    size_t size_;
+    size_t slot_;
+    void (*destroy_)(void*);
+    std::atomic<size_t> refs_ = 1;
+};
+
+template <typename T>
+class ShmSharedPtr {
+    template <typename Y, typename... Args>
+    friend ShmSharedPtr<Y> MakeShmShared(const std::string& name, Args&&... args);
+    template <typename Y>
+    friend ShmSharedPtr<Y> OpenShmShared(const std::string& name);
+
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    ShmSharedPtr() = default;
+    ShmSharedPtr(std::nullptr_t) {
+    }
+    ShmSharedPtr(const ShmSharedPtr& other) : ptr_(other.ptr_), attachment_(other.attachment_) {
+        if (attachment_ != nullptr) {
+            attachment_->IncRef();
+        }
+    }
+    ShmSharedPtr(ShmSharedPtr&& other)
+        : ptr_(std::exchange(other.ptr_, nullptr)),
+          attachment_(std::exchange(other.attachment_, nullptr)) {
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    ShmSharedPtr& operator=(const ShmSharedPtr& other) {
+        ShmSharedPtr(other).Swap(*this);
+        return *this;
+    }
+    ShmSharedPtr& operator=(ShmSharedPtr&& other) {
+        ShmSharedPtr(std::move(other)).Swap(*this);
+        return *this;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~ShmSharedPtr() {
+        Reset();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    void Reset() {
+        ptr_ = nullptr;
+        if (ShmAttachment* old = std::exchange(attachment_, nullptr)) {
+            old->DecRef();
+        }
+    }
+    void Swap(ShmSharedPtr& other) {
+        std::swap(ptr_, other.ptr_);
+        std::swap(attachment_, other.attachment_);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    T* Get() const {
+        return ptr_;
+    }
+    T& operator*() const {
+        return *ptr_;
+    }
+    T* operator->() const {
+        return ptr_;
+    }
+    explicit operator bool() const {
+        return ptr_ != nullptr;
+    }
+
+    // Number of processes holding the object, after reaping the ones that died.
+    size_t Holders() const {
+        if (attachment_ == nullptr) {
+            return 0;
+        }
+        ShmAttachment::Reap(attachment_->Header());
+        return attachment_->Header()->holders.load(std::memory_order_acquire);
+    }
+
+private:
+    ShmSharedPtr(T* ptr, ShmAttachment* attachment) : ptr_(ptr), attachment_(attachment) {
+    }
+
+    static void DestroyObject(void* object) {
+        static_cast<T*>(object)->~T();
+    }
+
+    T* ptr_ = nullptr;
+    ShmAttachment* attachment_ = nullptr;
+};
+
+// Offset of the object behind the header, with its alignment.
+template <typename T>
+constexpr size_t ShmObjectOffset() {
+    return (sizeof(ShmHeader) + alignof(T) - 1) / alignof(T) * alignof(T);
+}
+
+// Creates the segment `name` (e.g. "/dataset") holding a new `T`. Throws `std::system_error` if
+// it already exists or cannot be created.
+template <typename T, typename... Args>
+ShmSharedPtr<T> MakeShmShared(const std::string& name, Args&&... args) {
+    size_t size = ShmObjectOffset<T>() + sizeof(T);
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "shm_open");
+    }
+    void* memory = MAP_FAILED;
+    if (ftruncate(fd, static_cast<off_t>(size)) == 0) {
+        memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    int error = errno;
+    close(fd);
+    if (memory == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        throw std::system_error(error, std::generic_category(), "mmap");
+    }
+
+    auto* header = new (memory) ShmHeader{};
+    header->object_offset = static_cast<uint32_t>(ShmObjectOffset<T>());
+    header->object_size = sizeof(T);
+    T* object;
+    try {
+        object = new (static_cast<char*>(memory) + header->object_offset)
+            T(std::forward<Args>(args)...);
+    } catch (...) {
+        munmap(memory, size);
+        shm_unlink(name.c_str());
+        throw;
+    }
+    header->holders.store(1, std::memory_order_relaxed);
+    header->registry[0].store(getpid(), std::memory_order_relaxed);
+    header->magic.store(ShmHeader::kMagic, std::memory_order_release);
+    auto* attachment = new ShmAttachment(name, header, size, 0, &ShmSharedPtr<T>::DestroyObject);
+    return ShmSharedPtr<T>(object, attachment);
+}
+
+// Attaches to the segment `name` made by `MakeShmShared<T>`. Returns an empty pointer if the
+// segment does not exist, is not ready yet, holds another type, is already being destroyed, or
+// has no free registry slot.
+template <typename T>
+ShmSharedPtr<T> OpenShmShared(const std::string& name) {
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0) {
+        return nullptr;
+    }
+    size_t size = ShmObjectOffset<T>() + sizeof(T);
+    struct stat info;
+    void* memory = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && static_cast<size_t>(info.st_size) == size) {
+        memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (memory == MAP_FAILED) {
+        return nullptr;
+    }
+    auto* header = static_cast<ShmHeader*>(memory);
+    auto destroy = &ShmSharedPtr<T>::DestroyObject;
+    if (header->magic.load(std::memory_order_acquire) != ShmHeader::kMagic ||
+        header->object_size != sizeof(T) || header->object_offset != ShmObjectOffset<T>()) {
+        munmap(memory, size);
+        return nullptr;
+    }
+    if (ShmAttachment::Reap(header)) {
+        ShmAttachment::Destroy(name, header, destroy);
+        munmap(memory, size);
+        return nullptr;
+    }
+
+    // The count goes up before a slot is claimed: dying in between leaks the segment instead of
+    // destroying it under the other holders.
+    uint32_t holders = header->holders.load(std::memory_order_relaxed);
+    do {
+        if (holders == 0) {
+            munmap(memory, size);
+            return nullptr;
+        }
+    } while (!header->holders.compare_exchange_weak(holders, holders + 1,
+                                                    std::memory_order_acq_rel));
+    for (size_t slot = 0; slot < ShmHeader::kMaxHolders; ++slot) {
+        pid_t expected = 0;
+        if (header->registry[slot].compare_exchange_strong(expected, getpid(),
+                                                           std::memory_order_acq_rel)) {
+            auto* object = reinterpret_cast<T*>(static_cast<char*>(memory) + header->object_offset);
+            return ShmSharedPtr<T>(object, new ShmAttachment(name, header, size, slot, destroy));
+        }
+    }
+    if (header->holders.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        ShmAttachment::Destroy(name, header, destroy);
+    }
+    munmap(memory, size);
+    return nullptr;
+}
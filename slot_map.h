@@ -0,0 +1,172 @@
+#pragma once
+
+#include "sw_fwd.h"  // Forward declaration
+#include "borrow.h"
+#include "shared.h"
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+// Generational slot map: a compact alternative to keeping `WeakPtr`s to objects that live in a
+// registry. The map holds a `SharedPtr` to every object and hands out 8-byte `SlotHandle`s made of
+// a slot index and a generation. A handle goes stale when its object is erased, and the slot is
+// reused right away with the next generation, so a stale handle never reaches the new object.
+// Unlike a `WeakPtr`, a handle pins nothing: erasing releases the object and its storage at once.
+//
+// The slots form one contiguous array, each with the owning pointer next to its generation, so
+// checking a handle and finding its object takes one indexed load. The objects themselves stay in
+// their own allocations (with their block, for `Emplace`), as anything registered through
+// `Insert` already is. Free slots are reused most recent first, so holes never outnumber the
+// objects erased since the last insertion.
+
+template <typename T>
+class SlotMap;
+
+template <typename T>
+class SlotHandle {
+    friend class SlotMap<T>;
+
+public:
+    SlotHandle() = default;
+
+    uint32_t Index() const {
+        return index_;
+    }
+    uint32_t Generation() const {
+        return generation_;
+    }
+    explicit operator bool() const {
+        return index_ != kNone;
+    }
+
+    friend bool operator==(const SlotHandle& left, const SlotHandle& right) = default;
+
+private:
+    static constexpr uint32_t kNone = std::numeric_limits<uint32_t>::max();
+
+    SlotHandle(uint32_t index, uint32_t generation) : index_(index), generation_(generation) {
+    }
+
+    uint32_t index_ = kNone;
+    uint32_t generation_ = 0;
+};
+
+template <typename T>
+class SlotMap {
+    // A live slot owns its object, a free one links to the next free slot.
+    struct Slot {
+        SharedPtr<T> ptr;
+        uint32_t generation = 0;
+        uint32_t next_free = SlotHandle<T>::kNone;
+    };
+
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    // Registers an object that already has owners; the map becomes one of them. A pointer that
+    // was never shared gets its control block here: borrows from `Get()` must survive the slots
+    // moving when the map grows.
+    SlotHandle<T> Insert(SharedPtr<T> ptr) {
+        assert(ptr && "Empty pointers cannot be registered");
+        ptr.Block();
+        uint32_t index = free_;
+        if (index == SlotHandle<T>::kNone) {
+            assert(slots_.size() < SlotHandle<T>::kNone && "SlotMap is full");
+            index = static_cast<uint32_t>(slots_.size());
+            slots_.emplace_back();
+        } else {
+            free_ = slots_[index].next_free;
+        }
+        slots_[index].ptr = std::move(ptr);
+        ++size_;
+        return SlotHandle<T>(index, slots_[index].generation);
+    }
+
+    template <typename... Args>
+    SlotHandle<T> Emplace(Args&&... args) {
+        return Insert(MakeShared<T>(std::forward<Args>(args)...));
+    }
+
+    // Drops the map's reference. Returns false for stale handles.
+    bool Erase(SlotHandle<T> handle) {
+        if (!Contains(handle)) {
+            return false;
+        }
+        // Released on return, once the map is consistent again: the destructor may use the map.
+        SharedPtr<T> erased = std::move(slots_[handle.index_].ptr);
+        Free(handle.index_);
+        return true;
+    }
+
+    void Clear() {
+        for (uint32_t index = 0; index < slots_.size(); ++index) {
+            if (slots_[index].ptr) {
+                SharedPtr<T> erased = std::move(slots_[index].ptr);
+                Free(index);
+            }
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Lookup
+
+    bool Contains(SlotHandle<T> handle) const {
+        return handle.index_ < slots_.size() &&
+               slots_[handle.index_].generation == handle.generation_;
+    }
+
+    // Empty for stale handles. The borrow is valid until the object is erased.
+    BorrowPtr<T> Get(SlotHandle<T> handle) const {
+        if (!Contains(handle)) {
+            return nullptr;
+        }
+        return slots_[handle.index_].ptr;
+    }
+
+    // Shared ownership of the object, or an empty pointer for stale handles.
+    SharedPtr<T> Lock(SlotHandle<T> handle) const {
+        if (!Contains(handle)) {
+            return nullptr;
+        }
+        return slots_[handle.index_].ptr;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    size_t Size() const {
+        return size_;
+    }
+    bool Empty() const {
+        return size_ == 0;
+    }
+
+    // Calls `f(handle, ptr)` for every object, in slot order.
+    template <typename F>
+    void ForEach(F&& f) const {
+        for (uint32_t index = 0; index < slots_.size(); ++index) {
+            if (slots_[index].ptr) {
+                f(SlotHandle<T>(index, slots_[index].generation), slots_[index].ptr);
+            }
+        }
+    }
+
+private:
+    // A slot that ran out of generations is retired, so that no handle is ever reissued.
+    void Free(uint32_t index) {
+        --size_;
+        if (++slots_[index].generation != SlotHandle<T>::kNone) {
+            slots_[index].next_free = free_;
+            free_ = index;
+        }
+    }
+
+    std::vector<Slot> slots_;
+    uint32_t free_ = SlotHandle<T>::kNone;
+    size_t size_ = 0;
+};
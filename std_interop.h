@@ -0,0 +1,66 @@
+#pragma once
+
+#include "sw_fwd.h"  // Forward declaration
+#include "owner.h"
+#include "shared.h"
+
+#include <memory>
+#include <utility>
+
+// Sharing one ownership with `std::shared_ptr` at API boundaries, without copying the object.
+// Each direction costs at most one small allocation, and converting back is free: a
+// `std::shared_ptr` made by `ToStd` hands over the `SharedPtr` it holds, and a `SharedPtr` made
+// by `FromStd` hands over its `std::shared_ptr`, so round trips never nest wrappers.
+
+// Control block of a `SharedPtr` whose object is owned by a `std::shared_ptr`.
+class StdControlBlock final : public ControlBlockBase {
+public:
+    explicit StdControlBlock(std::shared_ptr<const void> owner) : owner_(std::move(owner)) {
+        strong_counter_ = 1;
+        weak_counter_ = 0;
+    }
+
+    std::shared_ptr<const void> owner_;
+
+    void DeleteData() override {
+        owner_.reset();
+    }
+};
+
+// Deleter of a `std::shared_ptr` that owns a `SharedPtr`: the object goes when the last owner on
+// either side does.
+template <typename T>
+struct StdBridge {
+    SharedPtr<T> owner_;
+
+    void operator()(T*) {
+        owner_.Reset();
+    }
+};
+
+template <typename T>
+std::shared_ptr<T> ToStd(SharedPtr<T> ptr) {
+    if (!OwnerAccess::Owner(ptr)) {
+        return std::shared_ptr<T>(std::shared_ptr<T>(), ptr.Get());
+    }
+    auto* block = dynamic_cast<const StdControlBlock*>(OwnerAccess::Block(ptr));
+    if (block != nullptr) {
+        return std::shared_ptr<T>(block->owner_, ptr.Get());
+    }
+    T* object = ptr.Get();
+    return std::shared_ptr<T>(object, StdBridge<T>{std::move(ptr)});
+}
+
+// A `std::shared_ptr` made by `ToStd` for another type than `T` is wrapped once more.
+template <typename T>
+SharedPtr<T> FromStd(std::shared_ptr<T> ptr) {
+    if (auto* bridge = std::get_deleter<StdBridge<T>>(ptr)) {
+        return SharedPtr<T>(bridge->owner_, ptr.get());
+    }
+    SharedPtr<T> result;
+    result.ptr_ = ptr.get();
+    if (ptr.use_count() != 0) {
+        result.cb_ = new StdControlBlock(std::move(ptr));
+    }
+    return result;
+}
@@ -1,16 +1,77 @@
 #pragma once
 
+#include "compressed_pair.h"
+
+#include <cstddef>
+#include <cstdint>
 #include <exception>
 #include <memory>
 
+#ifndef NDEBUG
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#endif
+
 class ControlBlockBase {
 public:
     size_t strong_counter_;
     size_t weak_counter_;
     virtual void DeleteData() = 0;
+    // Called once both counters reach zero. Pooled blocks override it to be reused.
+    virtual void DeleteBlock() {
+        delete this;
+    }
     virtual ~ControlBlockBase() = default;
 };
 
+#ifndef NDEBUG
+// Live `BorrowPtr`s per control block, or per `SharedPtr` for owners that were never shared.
+// Counted in debug builds only, and kept out of the block so that its layout is the same whether
+// `NDEBUG` is set or not. Borrows of objects owned on different threads may be counted
+// concurrently, hence the lock.
+class BorrowCounts {
+public:
+    static void Add(const void* owner) {
+        std::lock_guard lock(Mutex());
+        Counts()[owner]++;
+        Total()++;
+    }
+    static void Remove(const void* owner) {
+        std::lock_guard lock(Mutex());
+        auto it = Counts().find(owner);
+        if (--it->second == 0) {
+            Counts().erase(it);
+        }
+        Total()--;
+    }
+    // Every `SharedPtr` asks when it lets go, so the common case of no borrows at all skips the
+    // lock.
+    static bool Any(const void* owner) {
+        if (Total() == 0) {
+            return false;
+        }
+        std::lock_guard lock(Mutex());
+        return Counts().contains(owner);
+    }
+
+private:
+    // Never destroyed: borrows in static objects may outlive any other static.
+    static std::unordered_map<const void*, size_t>& Counts() {
+        static auto* counts = new std::unordered_map<const void*, size_t>();
+        return *counts;
+    }
+    static std::mutex& Mutex() {
+        static auto* mutex = new std::mutex();
+        return *mutex;
+    }
+    static std::atomic<size_t>& Total() {
+        static std::atomic<size_t> total = 0;
+        return total;
+    }
+};
+#endif
+
 template <typename T>
 class ControlBlockWithObject : public ControlBlockBase {
 public:
@@ -45,6 +106,71 @@ public:
     }
 };
 
+// Stand-in control block of a pointer adopted by `SharedPtr(T*)` that has not been shared yet.
+// There is one per type, holding the function that deletes such objects: it is bound where the
+// pointer is adopted, so that owners can be copied and destroyed where `T` is incomplete (pimpl)
+// or its destructor is not accessible. The owner deletes the object through it, or moves it into
+// a real block on the first share. Real blocks never reach its strong count, which marks it.
+class DeferredControlBlock : public ControlBlockBase {
+public:
+    static constexpr size_t kMark = SIZE_MAX;
+
+    constexpr explicit DeferredControlBlock(void (*destroy)(void*)) : destroy_(destroy) {
+        strong_counter_ = kMark;
+        weak_counter_ = 0;
+    }
+
+    void (*const destroy_)(void*);
+
+    void DeleteData() override {
+    }
+};
+
+template <typename T>
+void DeleteAdopted(void* object) {
+    delete static_cast<T*>(object);
+}
+
+template <typename T>
+constinit inline DeferredControlBlock deferred_control_block{&DeleteAdopted<T>};
+
+// Owns an object together with the deleter it was created with, e.g. one adopted from `UniquePtr`.
+template <typename T, typename D>
+class ControlBlockWithDeleter : public ControlBlockBase {
+public:
+    template <typename E>
+    ControlBlockWithDeleter(T* ptr, E&& deleter) : data_(ptr, std::forward<E>(deleter)) {
+        strong_counter_ = 1;
+        weak_counter_ = 0;
+    }
+
+    CompressedPair<T*, D> data_;
+
+    void DeleteData() override {
+        data_.GetSecond()(data_.GetFirst());
+    }
+};
+
+// Hints the CPU that `cb` is about to have its counters updated.
+inline void PrefetchControlBlock(const ControlBlockBase* cb) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(cb, 1);
+#else
+    (void)cb;
+#endif
+}
+
+// Finalizer from MurmurHash3: spreads the few significant bits of an address over the whole word.
+inline size_t MixPointer(const void* ptr) {
+    uint64_t x = reinterpret_cast<uintptr_t>(ptr);
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return static_cast<size_t>(x);
+}
+
 struct NeedNewObject {};
 
 class BadWeakPtr : public std::exception {};
@@ -54,3 +180,36 @@ class SharedPtr;
 
 template <typename T>
 class WeakPtr;
+
+// `BorrowPtr` is trivially copyable only in release builds, which changes how it is passed by
+// value. Each build puts it in its own inline namespace, so object files built with and without
+// `NDEBUG` fail to link together instead of disagreeing silently.
+#ifdef NDEBUG
+#define BORROW_ABI_NAMESPACE borrow_release
+#else
+#define BORROW_ABI_NAMESPACE borrow_debug
+#endif
+
+inline namespace BORROW_ABI_NAMESPACE {
+template <typename T>
+class BorrowPtr;
+}
+
+template <typename T, size_t Bits>
+class TaggedSharedPtr;
+
+template <typename T, typename Tag>
+class OffsetSharedPtr;
+
+class SharedBuffer;
+
+template <typename T>
+struct DefaultDeleter;
+
+template <typename T>
+class ShareableDelete;
+
+template <typename T, typename D = DefaultDeleter<T>>
+class UniquePtr;
+
+struct OwnerAccess;
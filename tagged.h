@@ -0,0 +1,291 @@
+#pragma once
+
+#include "sw_fwd.h"  // Forward declaration
+#include "intrusive.h"
+#include "shared.h"
+
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <cstddef>  // std::nullptr_t
+#include <cstdint>
+#include <utility>
+
+// Owning pointers with a few tag bits (marks, colors, ABA counters) kept in the low bits of an
+// address that alignment leaves at zero, so an edge of a compact or lock-free structure needs no
+// separate tag word. `TaggedIntrusivePtr` tags the object pointer itself; `TaggedSharedPtr` tags
+// its control block pointer, which is aligned whatever the object is, and stays two words wide.
+//
+// `Raw()` exposes the tagged word, e.g. to publish it in a `std::atomic<uintptr_t>`, and
+// `CompareExchangeTag` updates the tag in place with a CAS while the pointer stays the same.
+
+// Low address bits that are always zero for a `T`.
+template <typename T>
+inline constexpr size_t kAlignmentBits = std::countr_zero(alignof(T));
+
+template <size_t Bits>
+struct TagBits {
+    static constexpr uintptr_t kMask = (uintptr_t{1} << Bits) - 1;
+
+    static uintptr_t Pack(const void* ptr, uintptr_t tag) {
+        assert((tag & ~kMask) == 0 && "Tag does not fit");
+        assert((reinterpret_cast<uintptr_t>(ptr) & kMask) == 0 && "Misaligned pointer");
+        return reinterpret_cast<uintptr_t>(ptr) | tag;
+    }
+    static uintptr_t Address(uintptr_t word) {
+        return word & ~kMask;
+    }
+    static uintptr_t Tag(uintptr_t word) {
+        return word & kMask;
+    }
+
+    // Replaces the tag of `word` if it still holds `expected`, using the current pointer bits.
+    static bool CompareExchange(uintptr_t& word, uintptr_t expected, uintptr_t desired) {
+        assert((desired & ~kMask) == 0 && "Tag does not fit");
+        std::atomic_ref<uintptr_t> ref(word);
+        uintptr_t current = ref.load(std::memory_order_relaxed);
+        do {
+            if (Tag(current) != expected) {
+                return false;
+            }
+        } while (!ref.compare_exchange_weak(current, Address(current) | desired,
+                                            std::memory_order_acq_rel, std::memory_order_relaxed));
+        return true;
+    }
+};
+
+template <typename T, size_t Bits>
+class TaggedIntrusivePtr {
+    using Tags = TagBits<Bits>;
+
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    TaggedIntrusivePtr() = default;
+    TaggedIntrusivePtr(std::nullptr_t) {
+    }
+    explicit TaggedIntrusivePtr(T* ptr, uintptr_t tag = 0) : word_(Pack(ptr, tag)) {
+        if (ptr != nullptr) {
+            ptr->IncRef();
+        }
+    }
+    TaggedIntrusivePtr(T* ptr, AdoptRef, uintptr_t tag = 0) : word_(Pack(ptr, tag)) {
+    }
+    explicit TaggedIntrusivePtr(IntrusivePtr<T> ptr, uintptr_t tag = 0)
+        : word_(Pack(ptr.Detach(), tag)) {
+    }
+
+    TaggedIntrusivePtr(const TaggedIntrusivePtr& other) : word_(other.word_) {
+        if (T* ptr = Get()) {
+            ptr->IncRef();
+        }
+    }
+    TaggedIntrusivePtr(TaggedIntrusivePtr&& other) : word_(std::exchange(other.word_, 0)) {
+    }
+
+    // Takes over a reference released with `ReleaseRaw()`.
+    static TaggedIntrusivePtr FromRaw(uintptr_t word) {
+        TaggedIntrusivePtr result;
+        result.word_ = word;
+        return result;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    TaggedIntrusivePtr& operator=(const TaggedIntrusivePtr& other) {
+        TaggedIntrusivePtr(other).Swap(*this);
+        return *this;
+    }
+    TaggedIntrusivePtr& operator=(TaggedIntrusivePtr&& other) {
+        TaggedIntrusivePtr(std::move(other)).Swap(*this);
+        return *this;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~TaggedIntrusivePtr() {
+        Reset();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    void Reset() {
+        if (T* old = PointerOf(std::exchange(word_, 0))) {
+            old->DecRef();
+        }
+    }
+    void Swap(TaggedIntrusivePtr& other) {
+        std::swap(word_, other.word_);
+    }
+    void SetTag(uintptr_t tag) {
+        word_ = Tags::Address(word_) | Pack(nullptr, tag);
+    }
+    bool CompareExchangeTag(uintptr_t expected, uintptr_t desired) {
+        return Tags::CompareExchange(word_, expected, desired);
+    }
+
+    // Gives up the reference together with the tag; see `FromRaw`.
+    [[nodiscard]] uintptr_t ReleaseRaw() {
+        return std::exchange(word_, 0);
+    }
+    // Drops the tag and hands the reference over to a plain `IntrusivePtr`.
+    IntrusivePtr<T> Untag() && {
+        return IntrusivePtr<T>(PointerOf(ReleaseRaw()), AdoptRef{});
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    T* Get() const {
+        return PointerOf(word_);
+    }
+    T& operator*() const {
+        return *Get();
+    }
+    T* operator->() const {
+        return Get();
+    }
+    uintptr_t Tag() const {
+        return Tags::Tag(word_);
+    }
+    uintptr_t Raw() const {
+        return word_;
+    }
+    size_t UseCount() const {
+        T* ptr = Get();
+        return ptr == nullptr ? 0 : ptr->RefCount();
+    }
+    explicit operator bool() const {
+        return Get() != nullptr;
+    }
+
+    static T* PointerOf(uintptr_t word) {
+        return reinterpret_cast<T*>(Tags::Address(word));
+    }
+
+private:
+    // Checked here rather than in the class body, so that a node type can hold a tagged pointer
+    // to itself while still incomplete.
+    static uintptr_t Pack(const T* ptr, uintptr_t tag) {
+        static_assert(Bits <= kAlignmentBits<T>, "Not enough alignment bits for the tag");
+        return Tags::Pack(ptr, tag);
+    }
+
+    uintptr_t word_ = 0;
+};
+
+template <typename T, size_t Bits>
+class TaggedSharedPtr {
+    using Tags = TagBits<Bits>;
+
+    static_assert(Bits <= kAlignmentBits<ControlBlockBase>,
+                  "Not enough alignment bits in the control block pointer");
+
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    TaggedSharedPtr() = default;
+    TaggedSharedPtr(std::nullptr_t) {
+    }
+    // A pointer that was never shared gets its control block here, so that the tag has a word
+    // to live in.
+    explicit TaggedSharedPtr(SharedPtr<T> ptr, uintptr_t tag = 0)
+        : ptr_(ptr.ptr_), cb_(Tags::Pack(ptr.Block(), tag)) {
+        ptr.ptr_ = nullptr;
+        ptr.cb_ = nullptr;
+    }
+
+    TaggedSharedPtr(const TaggedSharedPtr& other) : ptr_(other.ptr_), cb_(other.cb_) {
+        if (ControlBlockBase* cb = Block()) {
+            cb->strong_counter_++;
+        }
+    }
+    TaggedSharedPtr(TaggedSharedPtr&& other)
+        : ptr_(std::exchange(other.ptr_, nullptr)), cb_(std::exchange(other.cb_, 0)) {
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    TaggedSharedPtr& operator=(const TaggedSharedPtr& other) {
+        TaggedSharedPtr(other).Swap(*this);
+        return *this;
+    }
+    TaggedSharedPtr& operator=(TaggedSharedPtr&& other) {
+        TaggedSharedPtr(std::move(other)).Swap(*this);
+        return *this;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~TaggedSharedPtr() {
+        Reset();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    // Released through a `SharedPtr`, so teardown and cycle collection work as usual.
+    void Reset() {
+        std::move(*this).Untag();
+    }
+    void Swap(TaggedSharedPtr& other) {
+        std::swap(ptr_, other.ptr_);
+        std::swap(cb_, other.cb_);
+    }
+    void SetTag(uintptr_t tag) {
+        cb_ = Tags::Address(cb_) | Tags::Pack(nullptr, tag);
+    }
+    bool CompareExchangeTag(uintptr_t expected, uintptr_t desired) {
+        return Tags::CompareExchange(cb_, expected, desired);
+    }
+
+    // Drops the tag and hands the reference over to a plain `SharedPtr`.
+    SharedPtr<T> Untag() && {
+        SharedPtr<T> owner;
+        owner.ptr_ = std::exchange(ptr_, nullptr);
+        owner.cb_ = reinterpret_cast<ControlBlockBase*>(Tags::Address(std::exchange(cb_, 0)));
+        return owner;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    T* Get() const {
+        return ptr_;
+    }
+    T& operator*() const {
+        return *ptr_;
+    }
+    T* operator->() const {
+        return ptr_;
+    }
+    uintptr_t Tag() const {
+        return Tags::Tag(cb_);
+    }
+    // The tagged control block word.
+    uintptr_t Raw() const {
+        return cb_;
+    }
+    size_t UseCount() const {
+        ControlBlockBase* cb = Block();
+        return cb == nullptr ? 0 : cb->strong_counter_;
+    }
+    explicit operator bool() const {
+        return ptr_ != nullptr;
+    }
+
+private:
+    ControlBlockBase* Block() const {
+        return reinterpret_cast<ControlBlockBase*>(Tags::Address(cb_));
+    }
+
+    T* ptr_ = nullptr;
+    uintptr_t cb_ = 0;
+};
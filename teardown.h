@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+// Iterative destruction for long chains and deep trees of owning pointers. Destroying a node
+// normally releases its children from inside its destructor, so a list of a few hundred thousand
+// nodes overflows the stack. Types that derive from `IterativeTeardown` are instead put on a
+// per-thread queue when their last owner goes, and the outermost release destroys the queue in a
+// loop: a node's children are queued while it is being destroyed, not destroyed inside it.
+//
+// Within a `TeardownBudget` scope every outermost release destroys at most that many objects, and
+// the rest waits for the following releases or an explicit `RunTeardown()`, which spreads the
+// teardown of a huge graph over time.
+struct IterativeTeardown {};
+
+class TeardownQueue {
+public:
+    struct Item {
+        void* object;
+        void (*destroy)(void*);
+    };
+
+    TeardownQueue() = default;
+    TeardownQueue(const TeardownQueue&) = delete;
+    TeardownQueue& operator=(const TeardownQueue&) = delete;
+    // Objects still queued when the thread exits, e.g. left behind by a `TeardownBudget`, are
+    // destroyed with the queue rather than leaked.
+    ~TeardownQueue() {
+        Run(std::numeric_limits<size_t>::max());
+    }
+
+    // Destroys up to `budget` queued objects, including whatever they queue in turn. Returns the
+    // number of objects left.
+    size_t Run(size_t budget) {
+        if (running_) {
+            return pending_.size();
+        }
+        running_ = true;
+        for (; budget != 0 && !pending_.empty(); --budget) {
+            Item item = pending_.back();
+            pending_.pop_back();
+            item.destroy(item.object);
+        }
+        running_ = false;
+        return pending_.size();
+    }
+
+    void Postpone(void* object, void (*destroy)(void*)) {
+        pending_.push_back({object, destroy});
+        Run(budget_);
+    }
+
+    size_t Pending() const {
+        return pending_.size();
+    }
+
+    size_t budget_ = std::numeric_limits<size_t>::max();
+
+private:
+    std::vector<Item> pending_;
+    bool running_ = false;
+};
+
+inline TeardownQueue& ThreadTeardownQueue() {
+    thread_local TeardownQueue queue;
+    return queue;
+}
+
+// Destroys `object` with `destroy` now, or later if a destruction is already in progress on this
+// thread.
+inline void PostponeTeardown(void* object, void (*destroy)(void*)) {
+    ThreadTeardownQueue().Postpone(object, destroy);
+}
+
+// Destroys queued objects left over by a `TeardownBudget`. Returns the number still queued.
+inline size_t RunTeardown(size_t budget = std::numeric_limits<size_t>::max()) {
+    return ThreadTeardownQueue().Run(budget);
+}
+
+inline size_t PendingTeardown() {
+    return ThreadTeardownQueue().Pending();
+}
+
+class TeardownBudget {
+public:
+    explicit TeardownBudget(size_t budget) : previous_(ThreadTeardownQueue().budget_) {
+        ThreadTeardownQueue().budget_ = budget;
+    }
+    TeardownBudget(const TeardownBudget&) = delete;
+    TeardownBudget& operator=(const TeardownBudget&) = delete;
+    ~TeardownBudget() {
+        ThreadTeardownQueue().budget_ = previous_;
+    }
+
+private:
+    size_t previous_;
+};
@@ -0,0 +1,838 @@
+#include "arena.h"
+#include "intrusive.h"
+#include "intrusive_weak.h"
+#include "persistent.h"
+#include "pool.h"
+#include "tagged.h"
+#include "trailing.h"
+
+#include <atomic>
+#include <cassert>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+///================================================================================================///
+
+struct Node : public SimpleRefCounted<Node> {
+    static int count;
+
+    explicit Node(std::string name = "") : name_(std::move(name)) {
+        ++count;
+    }
+    Node(const Node& other) : SimpleRefCounted<Node>(other), name_(other.name_) {
+        ++count;
+    }
+    Node& operator=(const Node& other) = default;
+    ~Node() {
+        --count;
+    }
+
+    std::string name_;
+};
+
+int Node::count = 0;
+
+struct Leaf : public Node {
+    Leaf() : Node("leaf") {
+    }
+};
+
+///================================================================================================///
+
+void IntrusiveEmptyState() {
+    IntrusivePtr<Node> a, b;
+    b = a;
+    IntrusivePtr c(a);
+    b = std::move(c);
+
+    assert(a.Get() == nullptr);
+    assert(b.Get() == nullptr);
+    assert(c.Get() == nullptr);
+    assert(a.UseCount() == 0);
+}
+
+///================================================================================================///
+
+void IntrusiveCopyMove() {
+    {   // SECTION("Copy")
+        auto a = MakeIntrusive<Node>("a");
+        IntrusivePtr<Node> b(a);
+        assert(a.UseCount() == 2);
+        b = a;
+        assert(a.UseCount() == 2);
+        b = b;  // NOLINT
+        assert(a.UseCount() == 2);
+        IntrusivePtr<Node> c;
+        c = b;
+        assert(a.UseCount() == 3);
+    }
+    assert(Node::count == 0);
+
+    {   // SECTION("Move")
+        auto a = MakeIntrusive<Node>("a");
+        IntrusivePtr<Node> b(std::move(a));
+        assert(!a);
+        assert(b.UseCount() == 1);
+        b = std::move(b);  // NOLINT
+        assert(b.UseCount() == 1);
+        auto c = MakeIntrusive<Node>("c");
+        c = std::move(b);
+        assert(Node::count == 1);
+        assert(c->name_ == "a");
+        assert(c.UseCount() == 1);
+    }
+    assert(Node::count == 0);
+
+    {   // SECTION("Conversions")
+        IntrusivePtr<Leaf> leaf = MakeIntrusive<Leaf>();
+        IntrusivePtr<Node> node(leaf);
+        assert(node.UseCount() == 2);
+        IntrusivePtr<Node> moved(std::move(leaf));
+        assert(moved.UseCount() == 2);
+    }
+    assert(Node::count == 0);
+}
+
+///================================================================================================///
+
+void IntrusiveModifiers() {
+    {   // SECTION("Reset")
+        auto a = MakeIntrusive<Node>();
+        IntrusivePtr<Node> b(a);
+        b.Reset(a.Get());
+        assert(a.UseCount() == 2);
+        b.Reset(new Node);
+        assert(a.UseCount() == 1);
+        assert(Node::count == 2);
+        b.Reset();
+        assert(Node::count == 1);
+    }
+    assert(Node::count == 0);
+
+    {   // SECTION("Swap")
+        auto a = MakeIntrusive<Node>("a");
+        auto b = MakeIntrusive<Node>("b");
+        a.Swap(b);
+        assert(a->name_ == "b");
+        assert(b->name_ == "a");
+    }
+    assert(Node::count == 0);
+}
+
+///================================================================================================///
+
+// Stand-in for a C API that hands out and takes back owned references.
+Node* CreateHandle() {
+    return MakeIntrusive<Node>("handle").Detach();
+}
+
+void DestroyHandle(Node* handle) {
+    IntrusivePtr<Node>(handle, AdoptRef{});
+}
+
+void IntrusiveAdoptRetain() {
+    {   // SECTION("Adopt")
+        Node* raw = CreateHandle();
+        assert(raw->RefCount() == 1);
+        IntrusivePtr<Node> p(raw, AdoptRef{});
+        assert(p.UseCount() == 1);
+    }
+    assert(Node::count == 0);
+
+    {   // SECTION("Retain")
+        auto p = MakeIntrusive<Node>();
+        IntrusivePtr<Node> q(p.Get(), RetainRef{});
+        assert(p.UseCount() == 2);
+    }
+    assert(Node::count == 0);
+
+    {   // SECTION("Detach and Release")
+        auto p = MakeIntrusive<Node>();
+        Node* raw = p.Detach();
+        assert(!p);
+        assert(raw->RefCount() == 1);
+        DestroyHandle(raw);
+        assert(Node::count == 0);
+
+        auto q = MakeIntrusive<Node>();
+        IntrusivePtr<Node>(q.Release(), AdoptRef{});
+        assert(Node::count == 0);
+    }
+}
+
+///================================================================================================///
+
+struct Compact : public RefCounted<Compact, SimpleCounter32, DefaultDelete> {
+    int32_t value = 0;
+};
+
+struct Tiny : public RefCounted<Tiny, SimpleCounter16, DefaultDelete> {
+    int16_t value = 0;
+};
+
+struct Wide : public SimpleRefCounted<Wide> {
+    int32_t value = 0;
+};
+
+struct Shared : public ThreadSafeRefCounted<Shared> {
+    static std::atomic<int> destroyed;
+
+    ~Shared() {
+        destroyed.fetch_add(1);
+    }
+};
+
+std::atomic<int> Shared::destroyed = 0;
+
+void IntrusiveCounterPolicies() {
+    {   // SECTION("Narrow counters fit next to small fields")
+        static_assert(sizeof(Compact) == 8);
+        static_assert(sizeof(Tiny) == 4);
+        static_assert(sizeof(Wide) == 16);
+
+        auto compact = MakeIntrusive<Compact>();
+        auto tiny = MakeIntrusive<Tiny>();
+        IntrusivePtr<Tiny> tiny_copy(tiny);
+        assert(compact.UseCount() == 1);
+        assert(tiny.UseCount() == 2);
+    }
+
+    {   // SECTION("Copies start without references")
+        auto a = MakeIntrusive<Node>("a");
+        IntrusivePtr<Node> a2(a);
+        auto b = MakeIntrusive<Node>(*a);
+        assert(b.UseCount() == 1);
+        *b = *a;
+        assert(b.UseCount() == 1);
+        assert(a.UseCount() == 2);
+    }
+    assert(Node::count == 0);
+
+    {   // SECTION("Atomic counter under contention")
+        constexpr int kThreads = 8;
+        constexpr int kIterations = 20000;
+        Shared::destroyed = 0;
+        // Outside of `Shared`: GCC 12 loses track of the object behind `moved` and warns about
+        // writes to it.
+        std::atomic<int> touched = 0;
+        auto shared = MakeIntrusive<Shared>();
+        std::vector<std::thread> threads;
+        for (int t = 0; t < kThreads; ++t) {
+            threads.emplace_back([copy = shared, &touched]() mutable {
+                for (int i = 0; i < kIterations; ++i) {
+                    IntrusivePtr<Shared> local(copy);
+                    IntrusivePtr<Shared> moved(std::move(local));
+                    if (moved.Get() == copy.Get()) {
+                        touched.fetch_add(1, std::memory_order_relaxed);
+                    }
+                }
+            });
+        }
+        shared.Reset();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        assert(touched == kThreads * kIterations);
+        assert(Shared::destroyed == 1);
+    }
+
+    {   // SECTION("Last release from any thread")
+        Shared::destroyed = 0;
+        for (int round = 0; round < 100; ++round) {
+            auto shared = MakeIntrusive<Shared>();
+            std::thread a([copy = shared]() mutable { copy.Reset(); });
+            std::thread b([copy = shared]() mutable { copy.Reset(); });
+            shared.Reset();
+            a.join();
+            b.join();
+        }
+        assert(Shared::destroyed == 100);
+    }
+}
+
+///================================================================================================///
+
+struct Observed : public RefCountedWithWeak<Observed> {
+    static int count;
+
+    Observed() {
+        ++count;
+    }
+    ~Observed() {
+        --count;
+    }
+
+    int value = 0;
+};
+
+int Observed::count = 0;
+
+struct SharedObserved : public RefCountedWithWeak<SharedObserved, AtomicCounter> {
+    static std::atomic<int> destroyed;
+
+    ~SharedObserved() {
+        destroyed.fetch_add(1);
+    }
+};
+
+std::atomic<int> SharedObserved::destroyed = 0;
+
+void IntrusiveWeak() {
+    {   // SECTION("No cost until observed")
+        static_assert(sizeof(Observed) == sizeof(Wide));
+        auto p = MakeIntrusive<Observed>();
+        IntrusivePtr<Observed> q(p);
+        assert(p.UseCount() == 2);
+    }
+    assert(Observed::count == 0);
+
+    {   // SECTION("Lock and expire")
+        IntrusiveWeakPtr<Observed> weak;
+        assert(weak.Expired());
+        assert(!weak.Lock());
+        {
+            auto p = MakeIntrusive<Observed>();
+            IntrusivePtr<Observed> p2(p);
+            weak = IntrusiveWeakPtr<Observed>(p);
+            IntrusiveWeakPtr<Observed> weak2(weak);
+            assert(p.UseCount() == 2);
+            assert(weak.UseCount() == 2);
+            auto locked = weak2.Lock();
+            assert(locked.Get() == p.Get());
+            assert(p.UseCount() == 3);
+        }
+        assert(Observed::count == 0);
+        assert(weak.Expired());
+        assert(!weak.Lock());
+    }
+
+    {   // SECTION("Observers outliving and outlived")
+        auto p = MakeIntrusive<Observed>();
+        {
+            IntrusiveWeakPtr<Observed> weak(p);
+            IntrusiveWeakPtr<Observed> moved(std::move(weak));
+            assert(weak.Expired());
+            assert(!moved.Expired());
+        }
+        IntrusiveWeakPtr<Observed> again(p);
+        p.Reset();
+        assert(Observed::count == 0);
+        assert(again.Expired());
+    }
+
+    {   // SECTION("First observation and Lock racing with other owners")
+        SharedObserved::destroyed = 0;
+        constexpr int kRounds = 200;
+        for (int round = 0; round < kRounds; ++round) {
+            auto p = MakeIntrusive<SharedObserved>();
+            std::thread copier([held = p]() mutable {
+                for (int i = 0; i < 100; ++i) {
+                    IntrusivePtr<SharedObserved> copy(held);
+                }
+                held.Reset();
+            });
+            std::thread observer([held = p]() mutable {
+                IntrusiveWeakPtr<SharedObserved> weak(held);
+                held.Reset();
+                for (int i = 0; i < 100; ++i) {
+                    if (auto locked = weak.Lock()) {
+                        assert(locked.UseCount() >= 1);
+                    }
+                }
+            });
+            p.Reset();
+            copier.join();
+            observer.join();
+        }
+        assert(SharedObserved::destroyed == kRounds);
+    }
+}
+
+///================================================================================================///
+
+struct Buffer : public PooledRefCounted<Buffer> {
+    static int live;
+    Buffer() {
+        ++live;
+    }
+    Buffer(const Buffer& other) : PooledRefCounted<Buffer>(other), data(other.data) {
+        ++live;
+    }
+    ~Buffer() {
+        --live;
+    }
+    void Reset() {
+        data.clear();
+    }
+    std::string data;
+};
+
+int Buffer::live = 0;
+
+void IntrusivePool() {
+    {   // SECTION("Last release returns the object")
+        ObjectPool<Buffer> pool(2);
+        static_assert(std::is_same_v<decltype(pool.Acquire()), IntrusivePtr<Buffer>>);
+        Buffer* raw;
+        {
+            auto a = pool.Acquire();
+            auto b = a;
+            a->data = "payload";
+            raw = a.Get();
+        }
+        assert(pool.Size() == 1);
+        assert(Buffer::live == 1);
+        auto c = pool.Acquire();
+        assert(c.Get() == raw);
+        assert(c->data.empty());
+        assert(c->RefCount() == 1);
+        assert(pool.Stats().hits == 1);
+    }
+    assert(Buffer::live == 0);
+
+    {   // SECTION("Copies and overflow are destroyed")
+        ObjectPool<Buffer> pool(1);
+        auto a = pool.Acquire();
+        auto b = pool.Acquire();
+        auto copy = MakeIntrusive<Buffer>(*a);
+        copy.Reset();
+        a.Reset();
+        b.Reset();
+        assert(pool.Size() == 1);
+        assert(pool.Stats().dropped == 1);
+        assert(Buffer::live == 1);
+    }
+    assert(Buffer::live == 0);
+
+    {   // SECTION("Objects outlive the pool")
+        IntrusivePtr<Buffer> survivor;
+        {
+            ObjectPool<Buffer> pool(4);
+            pool.Reserve(2);
+            survivor = pool.Acquire();
+        }
+        assert(Buffer::live == 1);
+    }
+    assert(Buffer::live == 0);
+}
+
+///================================================================================================///
+
+struct Chain : public SimpleRefCounted<Chain>, public IterativeTeardown {
+    static int count;
+
+    Chain() {
+        ++count;
+    }
+    ~Chain() {
+        --count;
+    }
+
+    IntrusivePtr<Chain> next;
+};
+
+int Chain::count = 0;
+
+void IntrusiveTeardown() {
+    {   // SECTION("Long chains are destroyed without recursion")
+        IntrusivePtr<Chain> head;
+        for (int i = 0; i < 300000; ++i) {
+            auto link = MakeIntrusive<Chain>();
+            link->next = std::move(head);
+            head = std::move(link);
+        }
+        head.Reset();
+        assert(Chain::count == 0);
+    }
+
+    {   // SECTION("Budgeted teardown")
+        IntrusivePtr<Chain> head;
+        for (int i = 0; i < 10; ++i) {
+            auto link = MakeIntrusive<Chain>();
+            link->next = std::move(head);
+            head = std::move(link);
+        }
+        {
+            TeardownBudget budget(4);
+            head.Reset();
+        }
+        assert(Chain::count == 6);
+        assert(RunTeardown() == 0);
+        assert(Chain::count == 0);
+    }
+}
+
+///================================================================================================///
+
+struct Marked : public SimpleRefCounted<Marked> {
+    TaggedIntrusivePtr<Marked, 2> next;  // Tagged while `Marked` is still incomplete
+};
+
+void IntrusiveTagged() {
+    static_assert(sizeof(TaggedIntrusivePtr<Node, 3>) == sizeof(Node*));
+    static_assert(kAlignmentBits<Node> >= 3);
+
+    {   // SECTION("Tag travels with the pointer")
+        auto node = MakeIntrusive<Node>("tagged");
+        TaggedIntrusivePtr<Node, 3> tagged(node, 5);
+        assert(tagged.Get() == node.Get() && tagged->name_ == "tagged");
+        assert(tagged.Tag() == 5 && tagged.UseCount() == 2);
+        auto copy = tagged;
+        assert(copy.Tag() == 5 && node.UseCount() == 3);
+        copy.SetTag(2);
+        assert(copy.Tag() == 2 && copy.Get() == node.Get() && tagged.Tag() == 5);
+        auto moved = std::move(copy);
+        assert(!copy && moved.Tag() == 2);
+        moved.Reset();
+        assert(node.UseCount() == 2);
+    }
+    assert(Node::count == 0);
+
+    {   // SECTION("Raw words and tag CAS")
+        TaggedIntrusivePtr<Node, 3> tagged(MakeIntrusive<Node>("raw"), 1);
+        assert(tagged.CompareExchangeTag(1, 6));
+        assert(!tagged.CompareExchangeTag(1, 0));
+        assert(tagged.Tag() == 6);
+        uintptr_t word = tagged.ReleaseRaw();
+        assert(!tagged && Node::count == 1);
+        assert((TaggedIntrusivePtr<Node, 3>::PointerOf(word)->name_ == "raw"));
+        auto back = TaggedIntrusivePtr<Node, 3>::FromRaw(word);
+        assert(back.Tag() == 6 && back.UseCount() == 1);
+        IntrusivePtr<Node> plain = std::move(back).Untag();
+        assert(!back && plain->name_ == "raw" && plain.UseCount() == 1);
+    }
+    assert(Node::count == 0);
+
+    {   // SECTION("Self-referencing nodes")
+        auto head = MakeIntrusive<Marked>();
+        head->next = TaggedIntrusivePtr<Marked, 2>(MakeIntrusive<Marked>(), 3);
+        assert(head->next.Tag() == 3 && head->next.UseCount() == 1);
+    }
+}
+
+///================================================================================================///
+
+struct GraphArena {};
+
+struct Vertex : public SimpleRefCounted<Vertex, ArenaDelete<GraphArena>> {
+    static int count;
+
+    explicit Vertex(int id = 0) : id_(id) {
+        if (id < 0) {
+            throw std::invalid_argument("Negative vertex id");
+        }
+        ++count;
+    }
+    ~Vertex() {
+        --count;
+    }
+
+    int id_;
+    OffsetIntrusivePtr<Vertex, GraphArena> left;
+    OffsetIntrusivePtr<Vertex, GraphArena> right;
+};
+
+int Vertex::count = 0;
+
+void IntrusiveOffset() {
+    static_assert(sizeof(OffsetIntrusivePtr<Vertex, GraphArena>) == 4);
+    static_assert(Arena<GraphArena>::kMaxCapacity == (size_t{32} << 30));
+
+    {   // SECTION("Offsets into the arena")
+        auto root = MakeOffsetIntrusive<Vertex, GraphArena>(1);
+        root->left = MakeOffsetIntrusive<Vertex, GraphArena>(2);
+        root->right = root->left;
+        assert(root->left.UseCount() == 2 && root->right->id_ == 2);
+        assert(root.Offset() != 0 && Arena<GraphArena>::Contains(root.Get()));
+        assert(Arena<GraphArena>::Address(root.Offset()) == root.Get());
+        OffsetIntrusivePtr<Vertex, GraphArena> empty;
+        assert(!empty && empty.Get() == nullptr && empty.UseCount() == 0);
+    }
+    assert(Vertex::count == 0);
+
+    {   // SECTION("Freed slots are reused")
+        size_t used = Arena<GraphArena>::Used();
+        Vertex* first = MakeOffsetIntrusive<Vertex, GraphArena>(3).Get();
+        auto second = MakeOffsetIntrusive<Vertex, GraphArena>(4);
+        assert(second.Get() == first);
+        assert(Arena<GraphArena>::Used() == used);
+    }
+
+    {   // SECTION("A throwing constructor gives the memory back")
+        size_t used = Arena<GraphArena>::Used();
+        for (int i = 0; i < 3; ++i) {
+            try {
+                MakeOffsetIntrusive<Vertex, GraphArena>(-1);
+                assert(false);
+            } catch (const std::invalid_argument&) {
+            }
+        }
+        assert(Arena<GraphArena>::Used() == used && Vertex::count == 0);
+    }
+
+    {   // SECTION("Conversions to full-width pointers")
+        IntrusivePtr<Vertex> wide = MakeOffsetIntrusive<Vertex, GraphArena>(5).Widen();
+        assert(wide.UseCount() == 1 && wide->id_ == 5);
+        OffsetIntrusivePtr<Vertex, GraphArena> narrow(std::move(wide));
+        assert(!wide && narrow.UseCount() == 1);
+        OffsetIntrusivePtr<Vertex, GraphArena> retained(narrow.Get());
+        assert(narrow.UseCount() == 2);
+    }
+    assert(Vertex::count == 0);
+
+    {   // SECTION("Objects outside the arena are rejected")
+        Vertex outside(6);
+        outside.IncRef();
+        try {
+            OffsetIntrusivePtr<Vertex, GraphArena> narrow(&outside);
+            assert(false);
+        } catch (const std::out_of_range&) {
+        }
+        assert(outside.RefCount() == 1);
+    }
+    assert(Vertex::count == 0);
+}
+
+///================================================================================================///
+
+struct Adjacency : public SimpleRefCounted<Adjacency>, public TrailingArray<Adjacency, std::string> {
+    static int count;
+
+    explicit Adjacency(int vertex) : vertex_(vertex) {
+        ++count;
+    }
+    ~Adjacency() {
+        --count;
+    }
+
+    int vertex_;
+};
+
+int Adjacency::count = 0;
+
+void IntrusiveTrailing() {
+    {   // SECTION("Header and elements together")
+        auto list = MakeIntrusiveWithTrailing<Adjacency, std::string>(3, 42);
+        assert(list->vertex_ == 42 && list->TrailingSize() == 3 && list.UseCount() == 1);
+        for (const std::string& name : list->Trailing()) {
+            assert(name.empty());
+        }
+        list->Trailing()[0] = "a long neighbour name that does not fit in place";
+        list->Trailing()[2] = "c";
+        IntrusivePtr<Adjacency> copy = list;
+        assert(copy->Trailing()[0].size() > 40 && copy->Trailing()[2] == "c");
+        const Adjacency& view = *copy;
+        assert(view.Trailing().size() == 3);
+    }
+    assert(Adjacency::count == 0);
+
+    {   // SECTION("No elements")
+        auto list = MakeIntrusiveWithTrailing<Adjacency, std::string>(0, 1);
+        assert(list->Trailing().empty());
+    }
+    assert(Adjacency::count == 0);
+}
+
+///================================================================================================///
+
+// Element without a default constructor that counts its live instances.
+struct Cell {
+    static int count;
+
+    explicit Cell(int value) : value(value) {
+        ++count;
+    }
+    Cell(const Cell& other) : value(other.value) {
+        ++count;
+    }
+    Cell& operator=(const Cell&) = default;
+    ~Cell() {
+        --count;
+    }
+
+    int value;
+};
+
+int Cell::count = 0;
+
+void IntrusivePersistentVector() {
+    {   // SECTION("Versions are independent")
+        PersistentVector<Cell> empty;
+        PersistentVector<Cell> one = empty.PushBack(Cell(1));
+        PersistentVector<Cell> two = one.PushBack(Cell(2));
+        assert(empty.Empty() && one.Size() == 1 && two.Size() == 2);
+        PersistentVector<Cell> changed = two.Set(0, Cell(10));
+        assert(two[0].value == 1 && changed[0].value == 10 && changed[1].value == 2);
+        assert(two.PopBack().Size() == 1 && two.Back().value == 2);
+    }
+    assert(Cell::count == 0);
+
+    {   // SECTION("Deep tries against a model")
+        constexpr int kSize = 40000;
+        std::vector<PersistentVector<Cell>> versions(1);
+        for (int i = 0; i < kSize; ++i) {
+            versions.push_back(versions.back().PushBack(Cell(i)));
+        }
+        for (int size : {0, 1, 31, 32, 33, 1024, 1056, 1057, 32800, kSize}) {
+            const auto& version = versions[static_cast<size_t>(size)];
+            assert(version.Size() == static_cast<size_t>(size));
+            for (int i = 0; i < size; i += 97) {
+                assert(version[static_cast<size_t>(i)].value == i);
+            }
+            if (size != 0) {
+                assert(version.Back().value == size - 1);
+            }
+        }
+        PersistentVector<Cell> full = versions.back();
+        versions.clear();
+        auto shrunk = full;
+        while (shrunk.Size() > 1000) {
+            shrunk = shrunk.PopBack();
+            assert(shrunk.Back().value == static_cast<int>(shrunk.Size()) - 1);
+        }
+        int expected = 0;
+        full.ForEach([&](const Cell& cell) {
+            assert(cell.value == expected++);
+        });
+        assert(expected == kSize);
+        bool threw = false;
+        try {
+            full.At(kSize);
+        } catch (const std::out_of_range&) {
+            threw = true;
+        }
+        assert(threw);
+    }
+    assert(Cell::count == 0);
+
+    {   // SECTION("Transients write in place once they own the path")
+        PersistentVector<int> base;
+        for (int i = 0; i < 100; ++i) {
+            base = base.PushBack(i);
+        }
+        auto transient = base.Transient();
+        transient.Set(5, -5);
+        const int* first = &transient[5];
+        transient.Set(5, -50);
+        transient.Mutable(6) = -6;
+        assert(&transient[5] == first && transient[5] == -50);
+        for (int i = 100; i < 2000; ++i) {
+            transient.PushBack(i);
+        }
+        transient.PopBack();
+        PersistentVector<int> result = std::move(transient).Persistent();
+        assert(base.Size() == 100 && base[5] == 5 && base[6] == 6);
+        assert(result.Size() == 1999 && result[1998] == 1998);
+        assert(result[5] == -50 && result[6] == -6);
+    }
+}
+
+///================================================================================================///
+
+// Sends every key to one of a few buckets, so that paths run out of hash bits.
+struct CollidingHash {
+    size_t operator()(int key) const {
+        return static_cast<size_t>(key % 3);
+    }
+};
+
+void IntrusivePersistentHashMap() {
+    {   // SECTION("Versions are independent")
+        PersistentHashMap<std::string, int> empty;
+        auto one = empty.Set("one", 1);
+        auto two = one.Set("two", 2);
+        auto changed = two.Set("one", 10);
+        assert(empty.Empty() && one.Size() == 1 && two.Size() == 2 && changed.Size() == 2);
+        assert(*two.Find("one") == 1 && changed.At("one") == 10);
+        assert(one.Find("two") == nullptr && !empty.Contains("one"));
+        auto erased = changed.Erase("two");
+        assert(erased.Size() == 1 && !erased.Contains("two") && changed.Contains("two"));
+        assert(erased.Erase("missing").Size() == 1);
+    }
+
+    {   // SECTION("Large maps against a model")
+        constexpr int kKeys = 20000;
+        PersistentHashMap<int, int> map;
+        std::unordered_map<int, int> model;
+        std::vector<PersistentHashMap<int, int>> versions;
+        for (int i = 0; i < kKeys; ++i) {
+            int key = (i * 7919) % 50000;
+            map = map.Set(key, i);
+            model[key] = i;
+            if (i % 1000 == 0) {
+                versions.push_back(map);
+            }
+        }
+        for (int i = 0; i < kKeys; i += 3) {
+            int key = (i * 7919) % 50000;
+            map = map.Erase(key);
+            model.erase(key);
+        }
+        assert(map.Size() == model.size());
+        for (const auto& [key, value] : model) {
+            assert(map.At(key) == value);
+        }
+        size_t visited = 0;
+        map.ForEach([&](int key, int value) {
+            assert(model.at(key) == value);
+            ++visited;
+        });
+        assert(visited == model.size());
+        assert(versions[1].Size() == 1001 && versions[1].At(7919) == 1);
+    }
+
+    {   // SECTION("Full hash collisions")
+        PersistentHashMap<int, Cell, CollidingHash> map;
+        for (int i = 0; i < 30; ++i) {
+            map = map.Set(i, Cell(i));
+        }
+        auto older = map;
+        for (int i = 0; i < 30; i += 2) {
+            map = map.Erase(i);
+        }
+        assert(map.Size() == 15 && older.Size() == 30);
+        for (int i = 0; i < 30; ++i) {
+            assert(map.Contains(i) == (i % 2 == 1) && older.At(i).value == i);
+        }
+        for (int i = 1; i < 29; i += 2) {
+            map = map.Erase(i);
+        }
+        assert(map.Size() == 1 && map.At(29).value == 29);
+    }
+    assert(Cell::count == 0);
+
+    {   // SECTION("Transients")
+        PersistentHashMap<int, int> base = PersistentHashMap<int, int>().Set(1, 1).Set(2, 2);
+        auto transient = base.Transient();
+        for (int i = 0; i < 5000; ++i) {
+            transient.Set(i, -i);
+        }
+        assert(transient.Erase(2) && !transient.Erase(2));
+        assert(transient.Size() == 4999 && *transient.Find(4999) == -4999);
+        auto result = std::move(transient).Persistent();
+        assert(result.Size() == 4999 && !result.Contains(2));
+        assert(base.Size() == 2 && base.At(1) == 1 && base.At(2) == 2);
+    }
+}
+
+///================================================================================================///
+
+int main() {
+    IntrusiveEmptyState();
+    IntrusiveCopyMove();
+    IntrusiveModifiers();
+    IntrusiveAdoptRetain();
+    IntrusiveCounterPolicies();
+    IntrusiveWeak();
+    IntrusivePool();
+    IntrusiveTeardown();
+    IntrusiveTagged();
+    IntrusiveOffset();
+    IntrusiveTrailing();
+    IntrusivePersistentVector();
+    IntrusivePersistentHashMap();
+    return 0;
+}
@@ -0,0 +1,27 @@
+#include "test_pimpl.h"
+
+struct Pimpl::Impl {
+    static int alive;
+
+    explicit Impl(int value) : value_(value) {
+        ++alive;
+    }
+    ~Impl() {
+        --alive;
+    }
+
+    int value_;
+};
+
+int Pimpl::Impl::alive = 0;
+
+Pimpl::Pimpl(int value) : impl_(new Impl(value)) {
+}
+
+int Pimpl::Value() const {
+    return impl_->value_;
+}
+
+int Pimpl::Alive() {
+    return Impl::alive;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "shared.h"
+
+// Keeps its state behind a pointer to a type that is only complete in `test_pimpl.cpp`: other
+// files copy and destroy it without ever seeing `Impl`.
+class Pimpl {
+public:
+    explicit Pimpl(int value);
+
+    int Value() const;
+    // Number of `Impl`s alive.
+    static int Alive();
+
+private:
+    struct Impl;
+    SharedPtr<Impl> impl_;
+};
@@ -1,8 +1,55 @@
+#include "arena.h"
+#include "borrow.h"
+#include "cow.h"
 #include "intrusive.h"
+#include "mapped_file.h"
+#include "owner.h"
+#include "pool.h"
+#include "shared_buffer.h"
+#include "shared_string.h"
+#include "shm.h"
+#include "std_interop.h"
+#include "tagged.h"
+#include "trailing.h"
+#include "unique.h"
 #include "shared.h"
+#include "test_pimpl.h"
 #include "weak.h"
 
 #include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <new>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+///================================================================================================///
+
+// Counts heap allocations made by the whole program. Out of line, so that GCC does not pair the
+// `free` below with the `new` expressions it would otherwise be inlined next to.
+size_t allocations = 0;
+
+[[gnu::noinline]] void* operator new(size_t size) {
+    ++allocations;
+    if (void* ptr = std::malloc(size)) {
+        return ptr;
+    }
+    throw std::bad_alloc{};
+}
+[[gnu::noinline]] void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+[[gnu::noinline]] void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
 
 ///================================================================================================///
 
@@ -476,6 +523,1484 @@ void SharedDestructor() {
 
 ///================================================================================================///
 
+void SharedBatch() {
+    {   // SECTION("ShareN")
+        auto p = MakeShared<ModifiersC>();
+        std::vector<SharedPtr<ModifiersC>> out(5);
+        out[0] = MakeShared<ModifiersC>();
+        assert(ModifiersC::count == 2);
+        ShareN(p, std::span(out));
+        assert(ModifiersC::count == 1);
+        assert(p.UseCount() == 6);
+        for (const auto& q : out) {
+            assert(q.Get() == p.Get());
+        }
+        out.clear();
+        assert(p.UseCount() == 1);
+    }
+    assert(ModifiersC::count == 0);
+
+    {   // SECTION("ShareN empty")
+        SharedPtr<int> p;
+        std::vector<SharedPtr<int>> out(3, MakeShared<int>(1));
+        ShareN(p, std::span(out));
+        for (const auto& q : out) {
+            assert(q.Get() == nullptr);
+            assert(q.UseCount() == 0);
+        }
+    }
+
+    {   // SECTION("ReleaseAll")
+        auto a = MakeShared<ModifiersC>();
+        SharedPtr<ModifiersC> b(new ModifiersC);
+        std::vector<SharedPtr<ModifiersC>> ptrs;
+        for (int i = 0; i < 20; ++i) {
+            ptrs.push_back(i % 2 == 0 ? a : b);
+            ptrs.emplace_back();
+        }
+        ptrs.push_back(MakeShared<ModifiersC>());
+        assert(ModifiersC::count == 3);
+        assert(a.UseCount() == 11);
+        WeakPtr<ModifiersC> weak(b);
+        b.Reset();
+        ReleaseAll(std::span(ptrs));
+        assert(ModifiersC::count == 1);
+        assert(a.UseCount() == 1);
+        assert(weak.Expired());
+        for (const auto& q : ptrs) {
+            assert(q.Get() == nullptr);
+            assert(q.UseCount() == 0);
+        }
+        a.Reset();
+        assert(ModifiersC::count == 0);
+    }
+}
+
+///================================================================================================///
+
+int ReadBorrowed(BorrowPtr<const int> value) {
+    return *value;
+}
+
+void SharedBorrow() {
+    // Debug builds count borrows outside of the block, so it is as small as in release builds.
+    static_assert(sizeof(ControlBlockBase) == 3 * sizeof(void*));
+
+    {   // SECTION("From SharedPtr")
+        auto p = MakeShared<int>(7);
+        BorrowPtr<int> b(p);
+        BorrowPtr<const int> c = b;
+        assert(b.Get() == p.Get());
+        assert(c == b);
+        assert(p.UseCount() == 1);
+        assert(ReadBorrowed(p) == 7);
+        assert(p.UseCount() == 1);
+    }
+
+    {   // SECTION("From Lock() result")
+        auto p = MakeShared<int>(8);
+        WeakPtr<int> w(p);
+        assert(ReadBorrowed(w.Lock()) == 8);
+        assert(p.UseCount() == 1);
+    }
+
+    {   // SECTION("Promote")
+        SharedPtr<ModifiersC> owner;
+        {
+            auto p = MakeShared<ModifiersC>();
+            BorrowPtr<ModifiersC> b(p);
+            owner = b.Promote();
+            assert(p.UseCount() == 2);
+        }
+        assert(ModifiersC::count == 1);
+        owner.Reset();
+        assert(ModifiersC::count == 0);
+
+        BorrowPtr<int> empty;
+        assert(!empty);
+        assert(!empty.Promote());
+    }
+
+    {   // SECTION("From IntrusivePtr")
+        struct Node : SimpleRefCounted<Node> {
+            int value = 3;
+        };
+        auto p = MakeIntrusive<Node>();
+        BorrowPtr<Node> b(p);
+        assert(b->value == 3);
+        assert(p.UseCount() == 1);
+        assert(!b.Promote());
+    }
+}
+
+///================================================================================================///
+
+struct Self : public EnableSharedFromThis<Self> {
+    static int count;
+
+    Self() {
+        ++count;
+    }
+    Self(const Self& other) : EnableSharedFromThis(other) {
+        ++count;
+    }
+    ~Self() {
+        --count;
+        assert(!SharedFromThis());
+        weak_self_ = WeakFromThis();
+        assert(weak_self_.Expired());
+    }
+
+    WeakPtr<Self> weak_self_;
+};
+
+int Self::count = 0;
+
+void SharedFromThisTests() {
+    {   // SECTION("MakeShared")
+        auto p = MakeShared<Self>();
+        auto q = p->SharedFromThis();
+        assert(q.Get() == p.Get());
+        assert(p.UseCount() == 2);
+        WeakPtr<Self> w = p->WeakFromThis();
+        assert(w.UseCount() == 2);
+        const Self& ref = *p;
+        SharedPtr<const Self> c = ref.SharedFromThis();
+        assert(p.UseCount() == 3);
+    }
+    assert(Self::count == 0);
+
+    {   // SECTION("Raw pointer")
+        SharedPtr<Self> p(new Self);
+        assert(p->SharedFromThis().Get() == p.Get());
+        p.Reset(new Self);
+        assert(p->SharedFromThis().Get() == p.Get());
+        assert(Self::count == 1);
+    }
+    assert(Self::count == 0);
+
+    {   // SECTION("Not owned")
+        Self self;
+        assert(!self.SharedFromThis());
+        assert(self.WeakFromThis().Expired());
+    }
+
+    {   // SECTION("Copies are not shared")
+        auto p = MakeShared<Self>();
+        Self copy(*p);
+        assert(!copy.SharedFromThis());
+    }
+    assert(Self::count == 0);
+
+    {   // SECTION("Self observer outlives the object")
+        auto p = MakeShared<Self>();
+        p->weak_self_ = p->WeakFromThis();
+        p.Reset();
+        assert(Self::count == 0);
+    }
+
+    {   // SECTION("Object outlives its block")
+        Self self;
+        {
+            SharedPtr<Self> p(&self, [](Self*) {});
+            assert(self.SharedFromThis().Get() == &self);
+        }
+        assert(!self.SharedFromThis());
+        assert(self.WeakFromThis().Expired());
+        // A later owner takes over once the first one is gone.
+        SharedPtr<Self> q(&self, [](Self*) {});
+        assert(self.SharedFromThis() == q);
+    }
+    assert(Self::count == 0);
+
+    {   // SECTION("The first live owner is kept")
+        Self self;
+        SharedPtr<Self> first(&self, [](Self*) {});
+        SharedPtr<Self> second(&self, [](Self*) {});
+        auto shared = self.SharedFromThis();
+        assert(first.UseCount() == 2 && second.UseCount() == 1);
+    }
+    assert(Self::count == 0);
+}
+
+///================================================================================================///
+
+void SharedCasts() {
+    {   // SECTION("Static")
+        SharedPtr<Base> base = MakeShared<Derived>();
+        auto derived = StaticPointerCast<Derived>(base);
+        assert(derived.Get() == base.Get());
+        assert(base.UseCount() == 2);
+        auto moved = StaticPointerCast<Derived>(std::move(base));
+        assert(!base);
+        assert(moved.UseCount() == 2);
+    }
+
+    {   // SECTION("Dynamic")
+        SharedPtr<Base> base = MakeShared<Derived>();
+        SharedPtr<Base> other = MakeShared<Base>();
+        assert(!DynamicPointerCast<Derived>(other));
+        assert(!DynamicPointerCast<Derived>(std::move(other)));
+        assert(other.UseCount() == 1);
+        auto derived = DynamicPointerCast<Derived>(base);
+        assert(derived && base.UseCount() == 2);
+        derived = DynamicPointerCast<Derived>(std::move(base));
+        assert(!base);
+        assert(derived.UseCount() == 1);
+        Derived::i_was_deleted = false;
+        derived.Reset();
+        assert(Derived::i_was_deleted);
+    }
+
+    {   // SECTION("Const and reinterpret")
+        SharedPtr<const int> c = MakeShared<int>(5);
+        auto m = ConstPointerCast<int>(c);
+        *m = 6;
+        assert(*c == 6);
+        auto bytes = ReinterpretPointerCast<const unsigned char>(std::move(c));
+        assert(!c);
+        assert(bytes.UseCount() == 2);
+        auto back = ConstPointerCast<int>(ReinterpretPointerCast<const int>(std::move(bytes)));
+        assert(back.Get() == m.Get());
+        assert(m.UseCount() == 2);
+    }
+
+    {   // SECTION("Moving aliasing constructor")
+        Data::data_was_deleted = false;
+        {
+            SharedPtr<Data> sp(new Data{42, 3.14});
+            Data* raw = sp.Get();
+            SharedPtr<double> y(std::move(sp), &raw->y);
+            assert(!sp);
+            assert(y.UseCount() == 1);
+            assert(*y == 3.14);
+        }
+        assert(Data::data_was_deleted);
+    }
+}
+
+///================================================================================================///
+
+struct Request {
+    static int built;
+    static int destroyed;
+    Request() {
+        ++built;
+    }
+    ~Request() {
+        ++destroyed;
+    }
+    void Reset() {
+        body.clear();
+    }
+    std::vector<int> body;
+};
+
+int Request::built = 0;
+int Request::destroyed = 0;
+
+void SharedPool() {
+    {   // SECTION("Released objects are reset and reused")
+        ObjectPool<Request> pool(2);
+        Request* first;
+        {
+            auto a = pool.Acquire();
+            a->body.assign(100, 1);
+            first = a.Get();
+            assert(pool.Outstanding() == 1);
+        }
+        assert(pool.Size() == 1);
+        auto b = pool.Acquire();
+        assert(b.Get() == first);
+        assert(b->body.empty());
+        assert(b->body.capacity() >= 100);
+        assert(b.UseCount() == 1);
+        assert(Request::built == 1);
+        assert(pool.Stats().hits == 1 && pool.Stats().misses == 1);
+    }
+    assert(Request::destroyed == Request::built);
+
+    {   // SECTION("Capacity limits the free list")
+        ObjectPool<Request> pool(1);
+        pool.Reserve(5);
+        assert(pool.Size() == 1);
+        {
+            auto a = pool.Acquire();
+            auto b = pool.Acquire();
+            auto c = b;
+        }
+        assert(pool.Size() == 1);
+        assert(pool.Stats().recycled == 1 && pool.Stats().dropped == 1);
+        pool.Trim();
+        assert(pool.Size() == 0);
+    }
+    assert(Request::destroyed == Request::built);
+
+    {   // SECTION("Weak observers delay recycling")
+        ObjectPool<Request> pool(4);
+        WeakPtr<Request> w;
+        {
+            auto a = pool.Acquire();
+            w = a;
+        }
+        assert(w.Expired());
+        assert(pool.Size() == 0);
+        w.Reset();
+        assert(pool.Size() == 1);
+        auto b = pool.Acquire();
+        assert(b.UseCount() == 1);
+        assert(!w.Lock());
+    }
+
+    {   // SECTION("Objects outlive the pool")
+        SharedPtr<Request> survivor;
+        {
+            ObjectPool<Request> pool(4);
+            survivor = pool.Acquire();
+            pool.Acquire();
+        }
+        survivor->body.push_back(1);
+    }
+    assert(Request::destroyed == Request::built);
+}
+
+///================================================================================================///
+
+// `MakeShared` reaches the destructor through the block alone.
+class Sealed {
+public:
+    static int count;
+
+    Sealed() {
+        ++count;
+    }
+
+private:
+    ~Sealed() {
+        --count;
+    }
+
+    friend class ControlBlockWithObject<Sealed>;
+};
+
+int Sealed::count = 0;
+
+void SharedLazyBlock() {
+    {   // SECTION("Never shared: one allocation, plain delete")
+        Derived::i_was_deleted = false;
+        size_t before = allocations;
+        {
+            SharedPtr<Derived> p(new Derived);
+            assert(p.UseCount() == 1);
+            SharedPtr<Derived> moved(std::move(p));
+            moved.Swap(p);
+            assert(p.UseCount() == 1);
+        }
+        assert(allocations - before == 1);
+        assert(Derived::i_was_deleted);
+    }
+
+    {   // SECTION("First copy allocates the block once")
+        SharedPtr<int> p(new int(7));
+        size_t before = allocations;
+        SharedPtr<int> a(p);
+        SharedPtr<int> b(p);
+        assert(allocations - before == 1);
+        assert(p.UseCount() == 3);
+        a.Reset();
+        b.Reset();
+        assert(p.UseCount() == 1);
+        assert(*p == 7);
+    }
+
+    {   // SECTION("Weak pointers materialize the block")
+        SharedPtr<int> p(new int(1));
+        WeakPtr<int> w(p);
+        assert(!w.Expired());
+        p.Reset();
+        assert(w.Expired());
+    }
+
+    {   // SECTION("Owner queries never allocate")
+        SharedPtr<int> q(new int(2));
+        const SharedPtr<int> r(new int(3));
+        size_t before = allocations;
+        bool less = q.OwnerBefore(r);
+        assert(less == q.OwnerBefore(r) && less != r.OwnerBefore(q));
+        assert(!OwnerLess{}(q, q) && OwnerEqual{}(q, q) && !OwnerEqual{}(q, r));
+        assert(OwnerHash{}(q) == OwnerHash{}(q));
+        OwnerMap<SharedPtr<int>, int> map;
+        assert(!map.Contains(q) && !map.Erase(r));
+        assert(allocations == before);
+        assert(q.UseCount() == 1 && r.UseCount() == 1);
+
+        // Sharing gives the pointer a block, and the map keeps the key it stored.
+        map[q] = 4;
+        SharedPtr<int> copy = q;
+        assert(map.Contains(q) && map.Contains(copy) && *map.Find(q) == 4);
+        assert(OwnerEqual{}(q, copy) && OwnerHash{}(q) == OwnerHash{}(copy));
+    }
+
+    {   // SECTION("Borrowing leaves the block to Promote")
+        // Debug builds allocate to count borrows, so look at the owner rather than at the heap.
+        SharedPtr<Derived> p(new Derived);
+        {
+            BorrowPtr<Derived> borrow(p);
+            BorrowPtr<Base> base = borrow;
+            BorrowPtr<Derived> copy = borrow;
+            assert(base.Get() == p.Get() && copy == borrow);
+        }
+        assert(OwnerAccess::Block(p) == nullptr);
+        assert(p.UseCount() == 1);
+
+        BorrowPtr<Base> borrow(p);
+        assert(OwnerAccess::Block(p) == nullptr);
+        size_t before = allocations;
+        SharedPtr<Base> promoted = borrow.Promote();
+        assert(allocations - before == 1);
+        assert(p.UseCount() == 2 && promoted.Get() == p.Get());
+        assert(borrow.Promote().UseCount() == 3);
+        assert(allocations - before == 1);
+    }
+
+    {   // SECTION("Converting to a base keeps the right deleter")
+        Derived::i_was_deleted = false;
+        SharedPtr<Base> base(SharedPtr<Derived>(new Derived));
+        base.Reset();
+        assert(Derived::i_was_deleted);
+    }
+
+    {   // SECTION("Reset adopts lazily and batches see stand-ins")
+        SharedPtr<int> p;
+        size_t before = allocations;
+        p.Reset(new int(4));
+        assert(allocations - before == 1);
+        std::vector<SharedPtr<int>> v;
+        v.emplace_back(new int(5));
+        v.emplace_back(new int(6));
+        v.push_back(p);
+        v.push_back(p);
+        ReleaseAll(std::span(v));
+        assert(p.UseCount() == 1);
+        ShareN(p, std::span(v));
+        assert(p.UseCount() == 5);
+    }
+
+    {   // SECTION("Destructor only accessible to the block")
+        Sealed::count = 0;
+        {
+            auto p = MakeShared<Sealed>();
+            auto copy = p;
+            WeakPtr<Sealed> weak(p);
+            assert(p.UseCount() == 2 && Sealed::count == 1);
+        }
+        assert(Sealed::count == 0);
+    }
+
+    {   // SECTION("Owners of an incomplete type")
+        {
+            Pimpl alone(1);
+            assert(alone.Value() == 1 && Pimpl::Alive() == 1);
+        }
+        assert(Pimpl::Alive() == 0);
+        {
+            Pimpl a(2);
+            Pimpl b = a;
+            const Pimpl c(3);
+            Pimpl d = c;
+            b = c;
+            assert(b.Value() == 3 && d.Value() == 3);
+            assert(Pimpl::Alive() == 2);
+        }
+        assert(Pimpl::Alive() == 0);
+    }
+}
+
+///================================================================================================///
+
+struct Hybrid : public SharedRefCounted<Hybrid> {
+    static int count;
+
+    explicit Hybrid(int value = 0) : value_(value) {
+        ++count;
+    }
+    Hybrid(const Hybrid& other) : SharedRefCounted<Hybrid>(other), value_(other.value_) {
+        ++count;
+    }
+    virtual ~Hybrid() {
+        --count;
+    }
+
+    int value_;
+};
+
+int Hybrid::count = 0;
+
+struct HybridChild : public Hybrid {
+    using Hybrid::Hybrid;
+};
+
+void SharedIntrusiveInterop() {
+    {   // SECTION("One count on both sides, no allocations")
+        auto intrusive = MakeIntrusive<Hybrid>(5);
+        size_t before = allocations;
+        SharedPtr<Hybrid> shared(intrusive);
+        IntrusivePtr<Hybrid> back(shared);
+        SharedPtr<Hybrid> copy = shared;
+        assert(allocations == before);
+        assert(shared.UseCount() == 4);
+        assert(intrusive.UseCount() == 4);
+        intrusive.Reset();
+        back.Reset();
+        assert(copy.UseCount() == 2);
+        assert(Hybrid::count == 1);
+    }
+    assert(Hybrid::count == 0);
+
+    {   // SECTION("Moves steal the reference")
+        auto shared = MakeShared<Hybrid>(1);
+        IntrusivePtr<Hybrid> intrusive(std::move(shared));
+        assert(!shared);
+        assert(intrusive.UseCount() == 1);
+        SharedPtr<Hybrid> again(std::move(intrusive));
+        assert(!intrusive);
+        assert(again.UseCount() == 1);
+    }
+    assert(Hybrid::count == 0);
+
+    {   // SECTION("Adopting raw and unique pointers")
+        size_t before = allocations;
+        SharedPtr<Hybrid> a(new Hybrid);
+        SharedPtr<Hybrid> b(a.Get());
+        assert(allocations - before == 1);
+        assert(a.UseCount() == 2);
+        SharedPtr<Hybrid> base(MakeUnique<HybridChild>(3));
+        IntrusivePtr<Hybrid> intrusive(base);
+        assert(base.UseCount() == 2);
+        base.Reset();
+        assert(intrusive->value_ == 3);
+    }
+    assert(Hybrid::count == 0);
+
+    {   // SECTION("Copies of the object are not shared")
+        auto a = MakeShared<Hybrid>(2);
+        auto b = MakeShared<Hybrid>(*a);
+        assert(a.UseCount() == 1 && b.UseCount() == 1);
+    }
+    assert(Hybrid::count == 0);
+}
+
+///================================================================================================///
+
+void SharedStdInterop() {
+    {   // SECTION("One ownership on both sides")
+        Derived::i_was_deleted = false;
+        auto ours = MakeShared<Derived>();
+        std::shared_ptr<Derived> theirs = ToStd(ours);
+        assert(theirs.get() == ours.Get());
+        assert(ours.UseCount() == 2);
+        ours.Reset();
+        assert(!Derived::i_was_deleted);
+        theirs.reset();
+        assert(Derived::i_was_deleted);
+    }
+
+    {   // SECTION("Adopting a std::shared_ptr")
+        auto theirs = std::make_shared<int>(5);
+        SharedPtr<int> ours = FromStd(theirs);
+        assert(*ours == 5);
+        assert(theirs.use_count() == 2);
+        WeakPtr<int> weak = ours;
+        ours.Reset();
+        assert(weak.Expired());
+        assert(theirs.use_count() == 1);
+    }
+
+    {   // SECTION("Round trips do not nest")
+        SharedPtr<int> ours(new int(1));
+        auto theirs = ToStd(ours);
+        size_t before = allocations;
+        SharedPtr<int> back = FromStd(theirs);
+        assert(allocations == before);
+        assert(back.UseCount() == 3);
+        assert(OwnerAccess::Owner(back) == OwnerAccess::Owner(ours));
+
+        auto original = std::make_shared<int>(2);
+        SharedPtr<int> wrapped = FromStd(original);
+        before = allocations;
+        std::shared_ptr<int> unwrapped = ToStd(std::move(wrapped));
+        assert(allocations == before);
+        assert(!unwrapped.owner_before(original) && !original.owner_before(unwrapped));
+    }
+
+    {   // SECTION("Empty pointers")
+        assert(!ToStd(SharedPtr<int>()));
+        assert(!FromStd(std::shared_ptr<int>()));
+        assert(FromStd(std::shared_ptr<int>()).UseCount() == 0);
+    }
+}
+
+///================================================================================================///
+
+struct Link : public IterativeTeardown {
+    static int count;
+
+    Link() {
+        ++count;
+    }
+    ~Link() {
+        --count;
+    }
+
+    SharedPtr<Link> next;
+    WeakPtr<Link> prev;
+};
+
+int Link::count = 0;
+
+SharedPtr<Link> MakeChain(size_t length) {
+    SharedPtr<Link> head;
+    for (size_t i = 0; i < length; ++i) {
+        auto link = (i % 2 == 0) ? MakeShared<Link>() : SharedPtr<Link>(new Link);
+        if (head) {
+            head->prev = link;
+        }
+        link->next = std::move(head);
+        head = std::move(link);
+    }
+    return head;
+}
+
+void SharedTeardown() {
+    {   // SECTION("Long chains are destroyed without recursion")
+        auto head = MakeChain(300000);
+        assert(Link::count == 300000);
+        head.Reset();
+        assert(Link::count == 0);
+        assert(PendingTeardown() == 0);
+    }
+
+    {   // SECTION("Budgeted teardown spreads the work")
+        auto head = MakeChain(1000);
+        {
+            TeardownBudget budget(100);
+            head.Reset();
+            assert(Link::count == 900);
+            assert(PendingTeardown() == 1);
+            auto other = MakeShared<Link>();
+            other.Reset();
+            assert(Link::count == 801);
+        }
+        assert(RunTeardown(500) == 1);
+        assert(Link::count == 301);
+        assert(RunTeardown() == 0);
+        assert(Link::count == 0);
+    }
+
+    {   // SECTION("Weak observers of queued objects")
+        auto head = MakeChain(3);
+        WeakPtr<Link> queued = head->next;
+        TeardownBudget budget(1);
+        head.Reset();
+        assert(Link::count == 2);
+        assert(queued.Expired());
+        RunTeardown();
+        assert(Link::count == 0);
+        assert(queued.Expired());
+    }
+
+    {   // SECTION("Leftovers are destroyed at thread exit")
+        std::thread([] {
+            auto head = MakeChain(1000);
+            TeardownBudget budget(10);
+            head.Reset();
+            assert(Link::count == 990 && PendingTeardown() == 1);
+        }).join();
+        assert(Link::count == 0);
+    }
+}
+
+///================================================================================================///
+
+struct Node : public Collectable {
+    static int count;
+
+    Node() {
+        ++count;
+    }
+    ~Node() {
+        --count;
+    }
+
+    void Trace(CycleTracer& tracer) const override {
+        tracer(next);
+        tracer(other);
+    }
+
+    SharedPtr<Node> next;
+    SharedPtr<Node> other;
+};
+
+int Node::count = 0;
+
+void SharedCycles() {
+    {   // SECTION("Two-node cycle")
+        auto a = MakeShared<Node>();
+        auto b = SharedPtr<Node>(new Node);
+        a->next = b;
+        b->next = a;
+        WeakPtr<Node> weak = a;
+        a.Reset();
+        b.Reset();
+        assert(Node::count == 2);
+        assert(CollectCycles() == 2);
+        assert(Node::count == 0);
+        assert(weak.Expired());
+        assert(ThreadCycleCollector().PendingRoots() == 0);
+    }
+
+    {   // SECTION("Self-cycle")
+        auto a = MakeShared<Node>();
+        a->next = a;
+        a.Reset();
+        assert(CollectCycles() == 1);
+        assert(Node::count == 0);
+    }
+
+    {   // SECTION("Cycle referenced from outside is kept")
+        auto a = MakeShared<Node>();
+        auto b = MakeShared<Node>();
+        auto c = MakeShared<Node>();
+        a->next = b;
+        b->next = c;
+        c->next = a;
+        auto outside = b;
+        a.Reset();
+        b.Reset();
+        c.Reset();
+        assert(CollectCycles() == 0);
+        assert(Node::count == 3);
+        assert(outside.UseCount() == 2);
+        assert(outside->next->next->next == outside);
+        outside.Reset();
+        assert(CollectCycles() == 3);
+        assert(Node::count == 0);
+    }
+
+    {   // SECTION("Acyclic garbage is freed by counting alone")
+        auto a = MakeShared<Node>();
+        a->next = MakeShared<Node>();
+        auto copy = a;
+        copy.Reset();
+        a.Reset();
+        assert(Node::count == 0);
+        assert(CollectCycles() == 0);
+    }
+
+    {   // SECTION("Candidate dies before collection")
+        auto a = MakeShared<Node>();
+        auto copy = a;
+        copy.Reset();
+        assert(ThreadCycleCollector().PendingRoots() == 1);
+        a.Reset();
+        assert(Node::count == 0);
+        assert(CollectCycles() == 0);
+        assert(ThreadCycleCollector().PendingRoots() == 0);
+    }
+
+    {   // SECTION("Budgeted collection")
+        for (int i = 0; i < 3; ++i) {
+            auto a = MakeShared<Node>();
+            a->next = MakeShared<Node>();
+            a->next->next = a;
+            a->other = a->next;
+        }
+        assert(Node::count == 6);
+        size_t before = CycleStats().roots_examined;
+        assert(CollectCycles(1) == 2);
+        assert(CycleStats().roots_examined == before + 1);
+        assert(Node::count == 4);
+        CollectCycles();
+        assert(Node::count == 0);
+        assert(ThreadCycleCollector().PendingRoots() == 0);
+    }
+
+    {   // SECTION("Garbage reaching live objects")
+        auto live = MakeShared<Node>();
+        auto a = MakeShared<Node>();
+        a->next = a;
+        a->other = live;
+        a.Reset();
+        assert(CollectCycles() == 1);
+        assert(Node::count == 1);
+        assert(live.UseCount() == 1);
+    }
+
+    {   // SECTION("Aliasing members are not edges")
+        auto holder = MakeShared<int>(0);
+        auto live = MakeShared<Node>();
+        auto a = MakeShared<Node>();
+        a->next = a;
+        a->other = SharedPtr<Node>(holder, live.Get());
+        a.Reset();
+        assert(CollectCycles() == 1);
+        assert(Node::count == 1);
+        assert(live.UseCount() == 1 && holder.UseCount() == 1);
+    }
+    assert(Node::count == 0);
+    assert(CycleStats().objects_freed == 14);
+
+    {   // SECTION("Tracing budget")
+        // a -> b -> c -> a, and d <-> e with d -> a. Marking from d runs out of budget after
+        // reaching a, whose cycle was marked first, and has to give its references back.
+        auto a = MakeShared<Node>();
+        a->next = MakeShared<Node>();
+        a->next->next = MakeShared<Node>();
+        a->next->next->next = a;
+        auto d = MakeShared<Node>();
+        d->next = MakeShared<Node>();
+        d->next->next = d;
+        d->other = a;
+        WeakPtr<Node> weak_a = a;
+        WeakPtr<Node> weak_d = d;
+        a.Reset();
+        d.Reset();
+        assert(ThreadCycleCollector().PendingRoots() == 2);
+
+        size_t traced = CycleStats().objects_traced;
+        assert(CollectCycles(std::numeric_limits<size_t>::max(), 4) == 0);
+        assert(CycleStats().objects_traced - traced <= 2 * 4);
+        assert(Node::count == 5 && ThreadCycleCollector().PendingRoots() == 2);
+        assert(weak_a.UseCount() == 2 && weak_d.UseCount() == 1);
+
+        // The cycle through a fits, but it is still referenced from d.
+        assert(CollectCycles(std::numeric_limits<size_t>::max(), 3) == 0);
+        assert(ThreadCycleCollector().PendingRoots() == 1);
+        assert(CollectCycles(1, 5) == 5);
+        assert(Node::count == 0 && ThreadCycleCollector().PendingRoots() == 0);
+    }
+
+    {   // SECTION("Candidates are collected at thread exit")
+        SharedPtr<Node> survivor;
+        std::thread([&survivor] {
+            auto a = MakeShared<Node>();
+            a->next = MakeShared<Node>();
+            a->next->next = a;
+            a.Reset();
+            survivor = MakeShared<Node>();
+            auto copy = survivor;
+            copy.Reset();
+            assert(Node::count == 3 && ThreadCycleCollector().PendingRoots() == 2);
+        }).join();
+        assert(Node::count == 1);
+        survivor.Reset();
+        assert(Node::count == 0);
+    }
+
+    {   // SECTION("Owners that outlive the thread's collector")
+        std::thread([] {
+            // Constructed before the collector, so destroyed after it.
+            thread_local std::vector<SharedPtr<Node>> late;
+            auto a = MakeShared<Node>();
+            late.push_back(a);
+            late.push_back(a);
+            a.Reset();
+        }).join();
+        assert(Node::count == 0);
+    }
+}
+
+///================================================================================================///
+
+void SharedTagged() {
+    static_assert(sizeof(TaggedSharedPtr<char, 3>) == sizeof(SharedPtr<char>));
+
+    {   // SECTION("Tag in the control block pointer")
+        auto owner = MakeShared<int>(7);
+        TaggedSharedPtr<int, 3> tagged(owner, 4);
+        assert(*tagged == 7 && tagged.Tag() == 4);
+        assert(owner.UseCount() == 2 && tagged.UseCount() == 2);
+        auto copy = tagged;
+        copy.SetTag(1);
+        assert(owner.UseCount() == 3 && copy.Tag() == 1 && tagged.Tag() == 4);
+        assert(copy.CompareExchangeTag(1, 7) && copy.Tag() == 7);
+        assert(!copy.CompareExchangeTag(1, 0) && copy.Get() == owner.Get());
+        copy.Reset();
+        assert(!copy && owner.UseCount() == 2);
+        SharedPtr<int> back = std::move(tagged).Untag();
+        assert(!tagged && back == owner && owner.UseCount() == 2);
+    }
+
+    {   // SECTION("Pointer that was never shared")
+        TaggedSharedPtr<int, 2> tagged(SharedPtr<int>(new int(3)), 3);
+        assert(tagged.UseCount() == 1 && tagged.Tag() == 3 && *tagged == 3);
+        WeakPtr<int> weak = std::move(tagged).Untag();
+        assert(weak.Expired());
+    }
+
+    {   // SECTION("Tag on an empty pointer")
+        TaggedSharedPtr<int, 1> empty(SharedPtr<int>(), 1);
+        assert(!empty && empty.Tag() == 1 && empty.UseCount() == 0);
+    }
+}
+
+///================================================================================================///
+
+struct SharedArena {};
+
+struct Resident : public EnableSharedFromThis<Resident> {
+    static int count;
+
+    explicit Resident(int value = 0) : value_(value) {
+        if (value < 0) {
+            throw std::invalid_argument("Negative value");
+        }
+        ++count;
+    }
+    ~Resident() {
+        --count;
+    }
+
+    int value_;
+};
+
+int Resident::count = 0;
+
+void SharedOffset() {
+    static_assert(sizeof(OffsetSharedPtr<Resident, SharedArena>) == 8);
+
+    {   // SECTION("Arena-resident object and block")
+        auto ptr = MakeOffsetShared<Resident, SharedArena>(3);
+        assert(ptr->value_ == 3 && ptr.UseCount() == 1);
+        assert(Arena<SharedArena>::Contains(ptr.Get()));
+        auto copy = ptr;
+        assert(ptr.UseCount() == 2);
+        copy.Reset();
+        assert(!copy && ptr.UseCount() == 1);
+        assert(ptr->SharedFromThis().UseCount() == 2);
+    }
+    assert(Resident::count == 0);
+
+    {   // SECTION("A throwing constructor gives the memory back")
+        size_t used = Arena<SharedArena>::Used();
+        for (int i = 0; i < 3; ++i) {
+            try {
+                MakeOffsetShared<Resident, SharedArena>(-1);
+                assert(false);
+            } catch (const std::invalid_argument&) {
+            }
+        }
+        assert(Arena<SharedArena>::Used() == used && Resident::count == 0);
+    }
+
+    {   // SECTION("Widen and narrow")
+        auto ptr = MakeOffsetShared<Resident, SharedArena>(4);
+        size_t used = Arena<SharedArena>::Used();
+        SharedPtr<Resident> wide = std::move(ptr).Widen();
+        assert(!ptr && wide.UseCount() == 1);
+        WeakPtr<Resident> weak = wide;
+        OffsetSharedPtr<Resident, SharedArena> narrow(wide);
+        assert(wide.UseCount() == 2);
+        wide.Reset();
+        narrow.Reset();
+        assert(weak.Expired() && Resident::count == 0);
+        weak.Reset();
+        auto reused = MakeOffsetShared<Resident, SharedArena>(5);
+        assert(Arena<SharedArena>::Used() == used);
+    }
+    assert(Resident::count == 0);
+
+    {   // SECTION("Pointers from outside the arena are rejected")
+        auto heap = MakeShared<Resident>(6);
+        try {
+            OffsetSharedPtr<Resident, SharedArena> narrow(heap);
+            assert(false);
+        } catch (const std::out_of_range&) {
+        }
+        assert(heap.UseCount() == 1 && Resident::count == 1);
+        try {
+            OffsetSharedPtr<int, SharedArena> narrow(SharedPtr<int>(new int(7)));
+            assert(false);
+        } catch (const std::out_of_range&) {
+        }
+
+        auto resident = MakeOffsetShared<Resident, SharedArena>(8);
+        SharedPtr<Resident> alias(heap, resident.Get());
+        try {
+            OffsetSharedPtr<Resident, SharedArena> narrow(alias);
+            assert(false);
+        } catch (const std::out_of_range&) {
+        }
+        assert(heap.UseCount() == 2 && resident.UseCount() == 1);
+    }
+    assert(Resident::count == 0);
+}
+
+///================================================================================================///
+
+struct Dataset {
+    int values[256];
+    std::atomic<int> readers;
+};
+
+// Runs `child` in a forked process that leaves with `_exit(code)`, and returns `code`.
+template <typename F>
+int InChild(F child) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        _exit(child());
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+void SharedAcrossProcesses() {
+    std::string name = "/smartptr-test-" + std::to_string(getpid());
+
+    {   // SECTION("Object is shared between processes")
+        auto data = MakeShmShared<Dataset>(name);
+        for (int i = 0; i < 256; ++i) {
+            data->values[i] = i;
+        }
+        auto copy = data;
+        assert(data.Holders() == 1);
+        int code = InChild([&] {
+            auto mine = OpenShmShared<Dataset>(name);
+            if (!mine || mine.Holders() != 2 || mine->values[255] != 255) {
+                return 1;
+            }
+            mine->readers.fetch_add(1);
+            mine.Reset();
+            return 0;
+        });
+        assert(code == 0);
+        assert(data->readers.load() == 1 && data.Holders() == 1);
+        assert(!OpenShmShared<int>(name));
+    }
+    assert(!OpenShmShared<Dataset>(name));
+
+    {   // SECTION("Crashed holders are reaped")
+        auto data = MakeShmShared<Dataset>(name);
+        int code = InChild([&] {
+            auto mine = OpenShmShared<Dataset>(name);
+            return mine && mine.Holders() == 2 ? 0 : 1;  // `_exit` leaves without detaching
+        });
+        assert(code == 0);
+        assert(data.Holders() == 1);
+    }
+    assert(!OpenShmShared<Dataset>(name));
+
+    {   // SECTION("Last holder in another process reclaims the segment")
+        auto data = MakeShmShared<Dataset>(name);
+        bool threw = false;
+        try {
+            MakeShmShared<Dataset>(name);
+        } catch (const std::system_error&) {
+            threw = true;
+        }
+        assert(threw);
+        pid_t pid = fork();
+        if (pid == 0) {
+            auto mine = OpenShmShared<Dataset>(name);
+            mine->readers.store(1);
+            while (mine.Holders() != 1) {
+                usleep(1000);
+            }
+            mine.Reset();
+            _exit(OpenShmShared<Dataset>(name) ? 1 : 0);
+        }
+        while (data->readers.load() == 0) {
+            usleep(1000);
+        }
+        data.Reset();
+        int status = 0;
+        waitpid(pid, &status, 0);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+    assert(!OpenShmShared<Dataset>(name));
+}
+
+///================================================================================================///
+
+struct Record {
+    uint32_t key;
+    uint32_t value;
+};
+
+void SharedMappedFile() {
+    std::string path = "/tmp/smartptr-map-" + std::to_string(getpid());
+    {
+        std::FILE* file = std::fopen(path.c_str(), "wb");
+        for (uint32_t i = 0; i < 1024; ++i) {
+            Record record{i, i * 10};
+            std::fwrite(&record, sizeof(record), 1, file);
+        }
+        std::fclose(file);
+    }
+
+    {   // SECTION("Views keep the mapping alive")
+        SharedPtr<const Record> one;
+        SharedPtr<const Record[]> many;
+        {
+            MappedFile mapped = MapFileShared(path, {.populate = true, .advice = MADV_RANDOM});
+            assert(mapped.size == 1024 * sizeof(Record));
+            assert(mapped.Span().size() == mapped.size);
+            one = mapped.View<Record>(5 * sizeof(Record));
+            many = mapped.ViewArray<Record>(100 * sizeof(Record), 10);
+            assert(mapped.bytes.UseCount() == 3);
+            assert(static_cast<const void*>(one.Get()) == mapped.bytes.Get() + 5 * sizeof(Record));
+        }
+        assert(one->key == 5 && one->value == 50);
+        assert(many[9].key == 109 && (*many).value == 1000);
+        WeakPtr<const Record[]> weak = many;
+        one.Reset();
+        many.Reset();
+        assert(weak.Expired());
+    }
+
+    {   // SECTION("Bad views and files")
+        MappedFile mapped = MapFileShared(path, {.huge_pages = true});
+        bool out_of_range = false;
+        try {
+            mapped.ViewArray<Record>(1000 * sizeof(Record), 25);
+        } catch (const std::out_of_range&) {
+            out_of_range = true;
+        }
+        assert(out_of_range);
+        bool misaligned = false;
+        try {
+            mapped.View<Record>(2);
+        } catch (const std::invalid_argument&) {
+            misaligned = true;
+        }
+        assert(misaligned);
+        bool missing = false;
+        try {
+            MapFileShared(path + ".missing");
+        } catch (const std::system_error&) {
+            missing = true;
+        }
+        assert(missing);
+    }
+    std::remove(path.c_str());
+
+    {   // SECTION("Custom deleter")
+        int calls = 0;
+        {
+            SharedPtr<int[]> array(new int[4]{1, 2, 3, 4}, [&calls](int* ptr) {
+                ++calls;
+                delete[] ptr;
+            });
+            auto copy = array;
+            copy[2] = 7;
+            assert(array[2] == 7 && array.UseCount() == 2);
+        }
+        assert(calls == 1);
+    }
+}
+
+///================================================================================================///
+
+std::span<const std::byte> AsBytes(const std::string& text) {
+    return std::as_bytes(std::span(text.data(), text.size()));
+}
+
+std::string AsText(std::span<const std::byte> bytes) {
+    return std::string(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+}
+
+void SharedBuffers() {
+    {   // SECTION("One allocation for block and bytes")
+        size_t before = allocations;
+        auto buffer = SharedBuffer::Copy(AsBytes("hello world"), 64);
+        assert(allocations == before + 1);
+        assert(AsText(buffer.Bytes()) == "hello world");
+        assert(buffer.IsUnique() && buffer.TailRoom() == 64 - 11);
+    }
+
+    {   // SECTION("Slices share the block")
+        auto buffer = SharedBuffer::Copy(AsBytes("header:payload"));
+        size_t before = allocations;
+        auto payload = buffer.Slice(7, 7);
+        assert(allocations == before);
+        assert(AsText(payload.Bytes()) == "payload");
+        assert(payload.Data() == buffer.Data() + 7);
+        assert(buffer.UseCount() == 2);
+        auto inner = payload.Slice(3, 4);
+        assert(AsText(inner.Bytes()) == "load" && buffer.UseCount() == 3);
+        buffer.Clear();
+        assert(AsText(inner.Bytes()) == "load" && inner.UseCount() == 2);
+        bool threw = false;
+        try {
+            inner.Slice(2, 3);
+        } catch (const std::out_of_range&) {
+            threw = true;
+        }
+        assert(threw);
+    }
+
+    {   // SECTION("Appending in place and copy on write")
+        auto buffer = SharedBuffer::Allocate(16);
+        buffer.Append(AsBytes("abc"));
+        const std::byte* data = buffer.Data();
+        buffer.Append(AsBytes("def"));
+        assert(buffer.Data() == data && AsText(buffer.Bytes()) == "abcdef");
+
+        auto view = buffer.Slice(0, 3);
+        buffer.Append(AsBytes("g"));
+        assert(buffer.Data() != data && buffer.IsUnique());
+        assert(AsText(buffer.Bytes()) == "abcdefg" && AsText(view.Bytes()) == "abc");
+        view.Append(AsBytes("X"));
+        assert(AsText(view.Bytes()) == "abcX");
+
+        SharedBuffer empty;
+        empty.Append(AsBytes("grows"));
+        empty.Append(AsBytes(" from nothing"));
+        assert(AsText(empty.Bytes()) == "grows from nothing");
+        empty.MutableBytes()[0] = std::byte{'G'};
+        assert(AsText(empty.Bytes()) == "Grows from nothing");
+        assert(empty.Share()[0] == std::byte{'G'});
+    }
+
+    {   // SECTION("Weak observers see no in-place writes")
+        auto buffer = SharedBuffer::Allocate(16);
+        buffer.Append(AsBytes("abc"));
+        WeakPtr<const std::byte[]> observer(buffer.Share());
+        assert(buffer.UseCount() == 1 && !buffer.IsUnique());
+        const std::byte* data = buffer.Data();
+        buffer.Append(AsBytes("d"));
+        assert(buffer.Data() != data && buffer.IsUnique());
+        buffer.MutableBytes()[0] = std::byte{'A'};
+        assert(AsText(buffer.Bytes()) == "Abcd");
+        assert(observer.Expired());
+    }
+
+    {   // SECTION("Chains")
+        BufferChain chain;
+        chain.Append(SharedBuffer::Copy(AsBytes("GET ")));
+        chain.Append(SharedBuffer::Copy(AsBytes("/index")));
+        chain.Append(SharedBuffer());
+        chain.Append(SharedBuffer::Copy(AsBytes(".html")));
+        assert(chain.Size() == 15 && chain.Buffers().size() == 3);
+        BufferChain path = chain.Slice(4, 8);
+        assert(path.Buffers().size() == 2);
+        assert(path.Buffers()[0].Data() == chain.Buffers()[1].Data());
+        assert(AsText(path.Coalesce().Bytes()) == "/index.h");
+        assert(AsText(chain.Coalesce().Bytes()) == "GET /index.html");
+        assert(chain.Slice(4, 6).Coalesce().Data() == chain.Buffers()[1].Data());
+    }
+}
+
+///================================================================================================///
+
+struct Tracked {
+    static int count;
+
+    Tracked() : value(count++) {
+    }
+    ~Tracked() {
+        --count;
+    }
+
+    int value;
+};
+
+int Tracked::count = 0;
+
+struct Row : public TrailingArray<Row, Tracked> {
+    explicit Row(int id, bool fail = false) : id_(id) {
+        if (fail) {
+            throw std::runtime_error("Row");
+        }
+    }
+
+    int id_;
+};
+
+struct SharedRow : public SharedRefCounted<SharedRow>, public TrailingArray<SharedRow, double> {
+    double Sum() const {
+        double sum = 0;
+        for (double value : Trailing()) {
+            sum += value;
+        }
+        return sum;
+    }
+};
+
+void SharedTrailing() {
+    {   // SECTION("Block, header and elements in one allocation")
+        size_t before = allocations;
+        auto row = MakeSharedWithTrailing<Row, Tracked>(5, 7);
+        assert(allocations == before + 1);
+        assert(row->id_ == 7 && row->TrailingSize() == 5 && Tracked::count == 5);
+        auto elements = row->Trailing();
+        assert(reinterpret_cast<char*>(elements.data()) >= reinterpret_cast<char*>(row.Get() + 1));
+        for (size_t i = 0; i < elements.size(); ++i) {
+            assert(elements[i].value == static_cast<int>(i));
+        }
+        auto copy = row;
+        assert(row.UseCount() == 2);
+    }
+    assert(Tracked::count == 0);
+
+    {   // SECTION("Weak owners keep the memory, not the elements")
+        WeakPtr<Row> weak;
+        {
+            auto row = MakeSharedWithTrailing<Row, Tracked>(3, 1);
+            weak = row;
+        }
+        assert(weak.Expired() && Tracked::count == 0);
+    }
+
+    {   // SECTION("Failed construction")
+        bool threw = false;
+        try {
+            MakeSharedWithTrailing<Row, Tracked>(4, 1, true);
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+        assert(threw && Tracked::count == 0);
+    }
+
+    {   // SECTION("Empty array and embedded control blocks")
+        auto empty = MakeSharedWithTrailing<Row, Tracked>(0, 2);
+        assert(empty->Trailing().empty() && Tracked::count == 0);
+
+        size_t before = allocations;
+        auto row = MakeSharedWithTrailing<SharedRow, double>(4);
+        assert(allocations == before + 1);
+        assert(row->Sum() == 0.0);
+        row->Trailing()[1] = 1.5;
+        row->Trailing()[3] = 2.5;
+        IntrusivePtr<SharedRow> intrusive = row;
+        assert(intrusive->Sum() == 4.0 && row.UseCount() == 2);
+    }
+}
+
+///================================================================================================///
+
+void SharedStrings() {
+    static_assert(sizeof(SharedString) == 16);
+    const std::string text = "a key long enough to live on the heap";
+
+    {   // SECTION("Short strings are inline")
+        size_t before = allocations;
+        SharedString empty;
+        SharedString word("fifteen chars!!");
+        SharedString copy = word;
+        assert(allocations == before);
+        assert(empty.Empty() && empty.IsInline() && *empty.Data() == '\0');
+        assert(word.IsInline() && word.Size() == 15 && word.UseCount() == 0);
+        assert(copy == word && std::string(copy.Data()) == "fifteen chars!!");
+    }
+
+    {   // SECTION("Long strings are one shared allocation")
+        size_t before = allocations;
+        SharedString key(text);
+        assert(allocations == before + 1);
+        assert(!key.IsInline() && key.View() == text && key.Data()[text.size()] == '\0');
+        SharedString copy = key;
+        SharedString moved = std::move(copy);
+        assert(allocations == before + 1);
+        assert(key.UseCount() == 2 && moved.Data() == key.Data() && copy.Empty());
+        copy = moved;
+        assert(key.UseCount() == 3);
+        moved = SharedString("short");
+        assert(key.UseCount() == 2 && moved == "short");
+    }
+
+    {   // SECTION("Comparison and hashing")
+        SharedString first(text);
+        SharedString second(text);
+        SharedString other("another key long enough for the heap");
+        assert(first == second && first.Data() != second.Data());
+        assert(first != other && first < other);
+        assert(first == std::string_view(text) && first == text && first != "a key");
+        assert(first.Hash() == std::hash<std::string>{}(text));
+        assert(SharedString("tiny").Hash() == std::hash<std::string_view>{}("tiny"));
+        assert(std::hash<SharedString>{}(first) == first.Hash());
+    }
+
+    {   // SECTION("Hash map keys")
+        std::unordered_map<SharedString, int, SharedStringHash, std::equal_to<>> map;
+        map.emplace(SharedString(text), 1);
+        map.emplace(SharedString("short"), 2);
+        assert(map.find(std::string_view(text))->second == 1);
+        assert(map.find(std::string_view("short"))->second == 2);
+        assert(map.find(std::string_view("missing")) == map.end());
+        SharedString key = map.begin()->first;
+        assert(map.at(key) != 0);
+    }
+}
+
+///================================================================================================///
+
+struct Config {
+    static int copies;
+
+    Config() = default;
+    Config(const Config& other) : values(other.values) {
+        ++copies;
+    }
+
+    std::vector<int> values;
+};
+
+int Config::copies = 0;
+
+void SharedCopyOnWrite() {
+    {   // SECTION("Unique values are written in place")
+        auto config = MakeCow<Config>();
+        const Config* address = config.Get();
+        config.Mutate().values.push_back(1);
+        config.Mutate().values.push_back(2);
+        assert(config.Get() == address && Config::copies == 0);
+        assert(config.IsUnique() && config->values.size() == 2);
+    }
+
+    {   // SECTION("Shared values are cloned once")
+        auto config = MakeCow<Config>();
+        config.Mutate().values = {1, 2, 3};
+        CowPtr<Config> copy = config;
+        SharedPtr<const Config> snapshot = config.Snapshot();
+        assert(config.UseCount() == 3 && !config.IsUnique());
+        config.Update([](Config& value) {
+            value.values[0] = 10;
+            value.values.push_back(4);
+        });
+        assert(Config::copies == 1 && config.IsUnique());
+        assert(config->values.size() == 4 && config->values[0] == 10);
+        assert(copy->values.size() == 3 && snapshot->values[0] == 1);
+        assert(copy.Get() == snapshot.Get() && copy.UseCount() == 2);
+        config.Mutate().values[1] = 20;
+        assert(Config::copies == 1);
+    }
+
+    {   // SECTION("Weak observers count as readers")
+        Config::copies = 0;
+        auto config = MakeCow<Config>();
+        WeakPtr<const Config> observer = config.Snapshot();
+        assert(config.UseCount() == 1 && !config.IsUnique());
+        config.Mutate().values.push_back(5);
+        assert(Config::copies == 1 && config.IsUnique());
+        assert(observer.Expired());
+    }
+
+    {   // SECTION("Update returns the result of the batch")
+        auto config = MakeCow<Config>();
+        size_t size = config.Update([](Config& value) {
+            value.values.assign(8, 0);
+            return value.values.size();
+        });
+        assert(size == 8);
+        CowPtr<Config> empty;
+        assert(!empty && empty.UseCount() == 0 && !empty.IsUnique());
+    }
+}
+
+///================================================================================================///
+
 int main() {
     SharedEmptyState();
     SharedCopyMove();
@@ -486,5 +2011,23 @@ int main() {
     SharedAliasing();
     SharedTypeConversions();
     SharedDestructor();
+    SharedBatch();
+    SharedBorrow();
+    SharedFromThisTests();
+    SharedCasts();
+    SharedPool();
+    SharedLazyBlock();
+    SharedIntrusiveInterop();
+    SharedStdInterop();
+    SharedTeardown();
+    SharedCycles();
+    SharedTagged();
+    SharedOffset();
+    SharedAcrossProcesses();
+    SharedMappedFile();
+    SharedBuffers();
+    SharedTrailing();
+    SharedStrings();
+    SharedCopyOnWrite();
     return 0;
 }
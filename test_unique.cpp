@@ -0,0 +1,162 @@
+#include "shared.h"
+#include "unique.h"
+#include "weak.h"
+
+#include <cassert>
+#include <string>
+
+///================================================================================================///
+
+struct Counted {
+    static int count;
+
+    explicit Counted(int value = 0) : value_(value) {
+        ++count;
+    }
+    virtual ~Counted() {
+        --count;
+    }
+
+    int value_;
+};
+
+int Counted::count = 0;
+
+struct Child : public Counted {
+    using Counted::Counted;
+};
+
+struct Self : public EnableSharedFromThis<Self> {
+    int value_ = 0;
+};
+
+struct CountingDeleter {
+    int* calls;
+    void operator()(Counted* ptr) const {
+        ++*calls;
+        delete ptr;
+    }
+};
+
+///================================================================================================///
+
+void UniqueSize() {
+    static_assert(sizeof(UniquePtr<int>) == sizeof(int*));
+    static_assert(sizeof(UniquePtr<Counted, CountingDeleter>) == 2 * sizeof(void*));
+    static_assert(sizeof(CompressedPair<int, DefaultDeleter<int>>) == sizeof(int));
+    static_assert(sizeof(ControlBlockWithDeleter<int, DefaultDeleter<int>>) ==
+                  sizeof(ControlBlockWithPointer<int>));
+}
+
+///================================================================================================///
+
+void UniqueBasics() {
+    {   // SECTION("Ownership moves")
+        auto a = MakeUnique<Counted>(5);
+        assert(a->value_ == 5);
+        UniquePtr<Counted> b(std::move(a));
+        assert(!a && b);
+        UniquePtr<Counted> c;
+        c = std::move(b);
+        assert((*c).value_ == 5);
+        assert(Counted::count == 1);
+        c = nullptr;
+        assert(Counted::count == 0);
+    }
+
+    {   // SECTION("Release and Reset")
+        auto a = MakeUnique<Counted>(1);
+        Counted* raw = a.Release();
+        assert(!a);
+        a.Reset(raw);
+        a.Reset(new Counted(2));
+        assert(Counted::count == 1);
+        UniquePtr<Counted> b;
+        b.Swap(a);
+        assert(b->value_ == 2 && !a);
+    }
+    assert(Counted::count == 0);
+
+    {   // SECTION("Derived to base and custom deleter")
+        UniquePtr<Counted> base = MakeUnique<Child>(3);
+        assert(base->value_ == 3);
+        int calls = 0;
+        {
+            UniquePtr<Counted, CountingDeleter> custom(new Counted, CountingDeleter{&calls});
+            UniquePtr<Counted, CountingDeleter> moved(std::move(custom));
+        }
+        assert(calls == 1);
+    }
+    assert(Counted::count == 0);
+}
+
+///================================================================================================///
+
+void UniqueToShared() {
+    {   // SECTION("Plain unique pointer")
+        SharedPtr<Counted> shared(MakeUnique<Child>(4));
+        assert(shared.UseCount() == 1);
+        assert(shared->value_ == 4);
+        SharedPtr<Counted> empty(UniquePtr<Counted>{});
+        assert(!empty && empty.UseCount() == 0);
+    }
+    assert(Counted::count == 0);
+
+    {   // SECTION("Deleter is kept")
+        int calls = 0;
+        {
+            UniquePtr<Counted, CountingDeleter> unique(new Counted, CountingDeleter{&calls});
+            SharedPtr<Counted> shared(std::move(unique));
+            auto copy = shared;
+        }
+        assert(calls == 1);
+    }
+
+    {   // SECTION("Shareable promotion reuses the block")
+        auto unique = MakeUniqueShareable<Counted>(7);
+        Counted* raw = unique.Get();
+        SharedPtr<Counted> shared(std::move(unique));
+        assert(!unique);
+        assert(shared.Get() == raw);
+        assert(shared.UseCount() == 1);
+        WeakPtr<Counted> weak = shared;
+        shared.Reset();
+        assert(weak.Expired());
+    }
+    assert(Counted::count == 0);
+
+    {   // SECTION("Shareable object that is never shared")
+        auto unique = MakeUniqueShareable<Child>(1);
+        UniquePtr<Counted, ShareableDelete<Counted>> base(std::move(unique));
+        assert(Counted::count == 1);
+    }
+    assert(Counted::count == 0);
+
+    {   // SECTION("Shared from this after promotion")
+        SharedPtr<Self> shared(MakeUniqueShareable<Self>());
+        auto again = shared->SharedFromThis();
+        assert(shared.UseCount() == 2);
+        SharedPtr<Self> other(MakeUnique<Self>());
+        assert(other->SharedFromThis().UseCount() == 2);
+    }
+
+    {   // SECTION("Object outlives the block of its deleter")
+        Self self;
+        {
+            UniquePtr<Self, void (*)(Self*)> unique(&self, [](Self*) {});
+            SharedPtr<Self> shared(std::move(unique));
+            assert(self.SharedFromThis().UseCount() == 2);
+        }
+        assert(!self.SharedFromThis());
+        assert(self.WeakFromThis().Expired());
+    }
+}
+
+///================================================================================================///
+
+int main() {
+    UniqueSize();
+    UniqueBasics();
+    UniqueToShared();
+    return 0;
+}
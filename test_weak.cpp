@@ -1,8 +1,12 @@
 #include "intrusive.h"
+#include "owner.h"
 #include "shared.h"
+#include "slot_map.h"
 #include "weak.h"
 
 #include <cassert>
+#include <string>
+#include <vector>
 
 ///================================================================================================///
 
@@ -131,6 +135,153 @@ void SharedFromWeak() {
 
 ///================================================================================================///
 
+void OwnerComparisons() {
+    struct Pair {
+        int first;
+        int second;
+    };
+    auto p = MakeShared<Pair>(Pair{1, 2});
+    SharedPtr<int> first(p, &p->first);
+    SharedPtr<int> second(p, &p->second);
+    WeakPtr<Pair> weak(p);
+    auto other = MakeShared<Pair>(Pair{3, 4});
+
+    assert(!(first == second));
+    assert(OwnerEqual{}(first, second));
+    assert(OwnerEqual{}(p, weak));
+    assert(!OwnerEqual{}(p, other));
+    assert(OwnerHash{}(first) == OwnerHash{}(weak));
+    assert(!OwnerLess{}(first, second) && !OwnerLess{}(second, first));
+    assert(OwnerLess{}(p, other) != OwnerLess{}(other, p));
+    assert(p.OwnerBefore(other) == weak.OwnerBefore(other));
+
+    assert(std::hash<SharedPtr<int>>{}(first) == std::hash<int*>{}(&p->first));
+}
+
+///================================================================================================///
+
+void OwnerMapBasics() {
+    OwnerMap<WeakPtr<std::string>, int> map;
+    std::vector<SharedPtr<std::string>> owners;
+    for (int i = 0; i < 100; ++i) {
+        owners.push_back(MakeShared<std::string>(std::to_string(i)));
+        map[WeakPtr<std::string>(owners.back())] = i;
+    }
+    assert(map.Size() == 100);
+    for (int i = 0; i < 100; ++i) {
+        assert(*map.Find(owners[i]) == i);
+    }
+    assert(!map.TryEmplace(WeakPtr<std::string>(owners[5]), 42).second);
+    assert(*map.Find(owners[5]) == 5);
+
+    {   // SECTION("Expired keys")
+        WeakPtr<std::string> expired(owners[7]);
+        owners[7].Reset();
+        assert(expired.Expired());
+        assert(*map.Find(expired) == 7);
+        assert(map.PurgeExpired() == 1);
+        assert(map.Find(expired) == nullptr);
+        assert(map.Size() == 99);
+    }
+
+    {   // SECTION("Erase")
+        for (int i = 0; i < 100; i += 2) {
+            if (owners[i]) {
+                assert(map.Erase(owners[i]));
+            }
+        }
+        assert(!map.Erase(owners[0]));
+        assert(map.Size() == 49);
+        for (int i = 1; i < 100; i += 2) {
+            if (i != 7) {
+                assert(*map.Find(owners[i]) == i);
+            }
+        }
+        int sum = 0;
+        map.ForEach([&sum](const WeakPtr<std::string>& key, int& value) {
+            assert(!key.Expired());
+            sum += value;
+        });
+        assert(sum == 2500 - 7);
+    }
+
+    map.Clear();
+    assert(map.Empty());
+    assert(map.Find(owners[1]) == nullptr);
+
+    {   // SECTION("Existing keys do not grow the table")
+        OwnerMap<WeakPtr<std::string>, int> full;
+        // 14 entries fill 16 slots up to the load factor: one more insert would rehash.
+        for (int i = 0; i < 14; ++i) {
+            full.TryEmplace(WeakPtr<std::string>(owners[2 * i]), i);
+        }
+        int* first = full.Find(owners[0]);
+        auto [value, inserted] = full.TryEmplace(WeakPtr<std::string>(owners[0]), 42);
+        assert(!inserted && value == first && *value == 0);
+        assert(full.Find(owners[0]) == first);
+    }
+}
+
+///================================================================================================///
+
+void SlotMapHandles() {
+    static_assert(sizeof(SlotHandle<int>) == 8);
+
+    {   // SECTION("Insert, lookup and erase")
+        SlotMap<std::string> map;
+        auto a = map.Emplace("a");
+        auto owner = MakeShared<std::string>("b");
+        auto b = map.Insert(owner);
+        assert(owner.UseCount() == 2);
+        assert(map.Size() == 2);
+        assert(*map.Get(a) == "a");
+        assert(map.Get(b).Get() == owner.Get());
+        assert(map.Lock(b) == owner);
+        assert(!SlotHandle<std::string>() && !map.Get(SlotHandle<std::string>()));
+
+        assert(map.Erase(b));
+        assert(!map.Erase(b));
+        assert(owner.UseCount() == 1);
+        assert(!map.Contains(b) && !map.Get(b) && !map.Lock(b));
+        assert(*map.Get(a) == "a");
+    }
+
+    {   // SECTION("Slots are reused with a new generation")
+        SlotMap<int> map;
+        auto old = map.Emplace(1);
+        WeakPtr<int> weak = map.Lock(old);
+        map.Erase(old);
+        assert(weak.Expired());
+        auto fresh = map.Emplace(2);
+        assert(fresh.Index() == old.Index());
+        assert(fresh.Generation() != old.Generation());
+        assert(!map.Get(old));
+        assert(*map.Get(fresh) == 2);
+    }
+
+    {   // SECTION("Iteration skips erased objects")
+        SlotMap<int> map;
+        std::vector<SlotHandle<int>> handles;
+        for (int i = 0; i < 5; ++i) {
+            handles.push_back(map.Emplace(i));
+        }
+        map.Erase(handles[1]);
+        map.Erase(handles[3]);
+        int sum = 0;
+        map.ForEach([&](SlotHandle<int> handle, const SharedPtr<int>& ptr) {
+            assert(map.Get(handle).Get() == ptr.Get());
+            sum += *ptr;
+        });
+        assert(sum == 0 + 2 + 4);
+        assert(*map.Get(handles[4]) == 4);
+        map.Clear();
+        assert(map.Empty() && !map.Contains(handles[0]));
+        assert(map.Emplace(7).Index() < 5);
+    }
+}
+
+///================================================================================================///
+
 int main() {
     WeakEmpty();
     WeakPtrCopyMove();
@@ -138,6 +289,9 @@ int main() {
     WeakExpiration();
     WeakExtendsShared();
     SharedFromWeak();
+    OwnerComparisons();
+    OwnerMapBasics();
+    SlotMapHandles();
 
     return 0;
 }
\ No newline at end of file
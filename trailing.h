@@ -0,0 +1,170 @@
+#pragma once
+
+#include "sw_fwd.h"  // Forward declaration
+#include "intrusive.h"
+#include "shared.h"
+
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <new>
+#include <span>
+#include <utility>
+
+// Objects made of a fixed header and a runtime-sized array, such as strings, small vectors or
+// adjacency lists, without a second allocation for the array. A type derives from
+// `TrailingArray<Derived, Elem>`, and `MakeSharedWithTrailing<T, Elem>(count, args...)` or
+// `MakeIntrusiveWithTrailing<T, Elem>(count, args...)` allocates the header and `count`
+// value-initialized elements right behind it in one block; `SharedPtr` puts its control block in
+// front of them as well.
+//
+// The elements are constructed before the header and destroyed after it. `Trailing()` is empty
+// until the header's constructor has returned, so the constructor itself cannot fill them.
+
+template <typename Derived, typename Elem>
+class TrailingArray {
+    template <typename T>
+    friend class ControlBlockWithTrailing;
+    template <typename T, typename E, typename... Args>
+    friend IntrusivePtr<T> MakeIntrusiveWithTrailing(size_t count, Args&&... args);
+    template <typename T, typename E, typename... Args>
+    friend SharedPtr<T> MakeSharedWithTrailing(size_t count, Args&&... args);
+
+public:
+    TrailingArray() = default;
+    // The elements live outside of the object, so a copy would have none of its own.
+    TrailingArray(const TrailingArray&) = delete;
+    TrailingArray& operator=(const TrailingArray&) = delete;
+
+    std::span<Elem> Trailing() {
+        return {Elements(), size_};
+    }
+    std::span<const Elem> Trailing() const {
+        return {Elements(), size_};
+    }
+    size_t TrailingSize() const {
+        return size_;
+    }
+
+    // The block is larger than `Derived`, so the usual sized `delete` would free it with the wrong
+    // size. Lets `DefaultDelete` release intrusive objects.
+    static void operator delete(void* memory) {
+        ::operator delete(memory);
+    }
+
+protected:
+    ~TrailingArray() {
+        std::destroy_n(Elements(), size_);
+    }
+
+private:
+    // Offset of the first element from the start of the object.
+    static constexpr size_t Offset() {
+        return (sizeof(Derived) + alignof(Elem) - 1) / alignof(Elem) * alignof(Elem);
+    }
+
+    // Bytes taken by the object and `count` elements.
+    static size_t AllocationSize(size_t count) {
+        static_assert(alignof(Derived) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__ &&
+                          alignof(Elem) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__,
+                      "Over-aligned trailing storage is not supported");
+        if (count > (std::numeric_limits<size_t>::max() - Offset()) / sizeof(Elem)) {
+            throw std::bad_alloc();
+        }
+        return Offset() + count * sizeof(Elem);
+    }
+
+    // Constructs the elements and then the object in `memory`. On failure everything constructed
+    // is destroyed again, and `memory` is left to the caller.
+    template <typename... Args>
+    static Derived* Construct(void* memory, size_t count, Args&&... args) {
+        auto* elements = reinterpret_cast<Elem*>(static_cast<char*>(memory) + Offset());
+        std::uninitialized_value_construct_n(elements, count);
+        Derived* object;
+        try {
+            object = ::new (memory) Derived(std::forward<Args>(args)...);
+        } catch (...) {
+            std::destroy_n(elements, count);
+            throw;
+        }
+        static_cast<TrailingArray*>(object)->size_ = count;
+        return object;
+    }
+
+    Elem* Elements() const {
+        auto* object = const_cast<Derived*>(static_cast<const Derived*>(this));
+        return reinterpret_cast<Elem*>(reinterpret_cast<char*>(object) + Offset());
+    }
+
+    size_t size_ = 0;
+};
+
+// Control block of `MakeSharedWithTrailing`, followed by the object and its elements.
+template <typename T>
+class ControlBlockWithTrailing : public ControlBlockBase {
+public:
+    template <typename Elem, typename... Args>
+    static ControlBlockWithTrailing* Make(size_t count, Args&&... args) {
+        using Base = TrailingArray<T, Elem>;
+        void* memory = ::operator new(kObjectOffset + Base::AllocationSize(count));
+        auto* block = ::new (memory) ControlBlockWithTrailing();
+        try {
+            Base::Construct(block->Object(), count, std::forward<Args>(args)...);
+        } catch (...) {
+            block->~ControlBlockWithTrailing();
+            ::operator delete(memory);
+            throw;
+        }
+        return block;
+    }
+
+    T* Object() {
+        return reinterpret_cast<T*>(reinterpret_cast<char*>(this) + kObjectOffset);
+    }
+
+    void DeleteData() override {
+        Object()->~T();
+    }
+    void DeleteBlock() override {
+        this->~ControlBlockWithTrailing();
+        ::operator delete(this);
+    }
+
+private:
+    static constexpr size_t kObjectOffset =
+        (sizeof(ControlBlockBase) + alignof(T) - 1) / alignof(T) * alignof(T);
+
+    ControlBlockWithTrailing() {
+        strong_counter_ = 1;
+        weak_counter_ = 0;
+    }
+};
+
+template <typename T, typename Elem, typename... Args>
+IntrusivePtr<T> MakeIntrusiveWithTrailing(size_t count, Args&&... args) {
+    using Base = TrailingArray<T, Elem>;
+    void* memory = ::operator new(Base::AllocationSize(count));
+    try {
+        return IntrusivePtr<T>(Base::Construct(memory, count, std::forward<Args>(args)...));
+    } catch (...) {
+        ::operator delete(memory);
+        throw;
+    }
+}
+
+// Objects with an embedded control block (`SharedRefCounted`) are allocated as for
+// `MakeIntrusiveWithTrailing`; others get a `ControlBlockWithTrailing` in front.
+template <typename T, typename Elem, typename... Args>
+SharedPtr<T> MakeSharedWithTrailing(size_t count, Args&&... args) {
+    if constexpr (SharedPtr<T>::template kEmbedded<T>) {
+        return SharedPtr<T>(MakeIntrusiveWithTrailing<T, Elem>(count, std::forward<Args>(args)...));
+    } else {
+        auto* block =
+            ControlBlockWithTrailing<T>::template Make<Elem>(count, std::forward<Args>(args)...);
+        SharedPtr<T> result;
+        result.ptr_ = block->Object();
+        result.cb_ = block;
+        result.AttachThis(result.ptr_);
+        return result;
+    }
+}
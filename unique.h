@@ -0,0 +1,180 @@
+#pragma once
+
+#include "sw_fwd.h"  // Forward declaration
+#include "compressed_pair.h"
+
+#include <cstddef>  // std::nullptr_t
+#include <type_traits>
+#include <utility>
+
+// https://en.cppreference.com/w/cpp/memory/default_delete
+template <typename T>
+struct DefaultDeleter {
+    DefaultDeleter() = default;
+    template <typename Y>
+    DefaultDeleter(const DefaultDeleter<Y>&) {
+        static_assert(std::is_convertible_v<Y*, T*>, "Inconvertible types");
+    }
+
+    void operator()(T* ptr) const {
+        static_assert(sizeof(T) > 0, "Can't delete an incomplete type");
+        delete ptr;
+    }
+};
+
+// Deleter of objects made by `MakeUniqueShareable`: the object already sits inside a
+// `SharedPtr` control block, which `SharedPtr(UniquePtr&&)` takes over without allocating.
+// Unlike `DefaultDeleter` it has state, so such a `UniquePtr` is two words wide.
+template <typename T>
+class ShareableDelete {
+    template <typename Y>
+    friend class ShareableDelete;
+    template <typename Y>
+    friend class SharedPtr;
+
+public:
+    ShareableDelete() = default;
+    explicit ShareableDelete(ControlBlockBase* cb) : cb_(cb) {
+    }
+    template <typename Y>
+    ShareableDelete(const ShareableDelete<Y>& other) : cb_(other.cb_) {
+        static_assert(std::is_convertible_v<Y*, T*>, "Inconvertible types");
+    }
+
+    void operator()(T*) const {
+        cb_->DeleteData();
+        cb_->DeleteBlock();
+    }
+
+private:
+    ControlBlockBase* cb_ = nullptr;
+};
+
+// https://en.cppreference.com/w/cpp/memory/unique_ptr
+template <typename T, typename D>
+class UniquePtr {
+    template <typename Y, typename E>
+    friend class UniquePtr;
+
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    UniquePtr() : data_(nullptr, D()) {
+    }
+    UniquePtr(std::nullptr_t) : data_(nullptr, D()) {
+    }
+    explicit UniquePtr(T* ptr) : data_(ptr, D()) {
+    }
+    template <typename E>
+    UniquePtr(T* ptr, E&& deleter) : data_(ptr, std::forward<E>(deleter)) {
+    }
+
+    UniquePtr(const UniquePtr&) = delete;
+    UniquePtr(UniquePtr&& other) : data_(other.Release(), std::move(other.GetDeleter())) {
+    }
+    template <typename Y, typename E>
+    UniquePtr(UniquePtr<Y, E>&& other)
+        : data_(other.Release(), std::move(other.GetDeleter())) {
+        static_assert(std::is_convertible_v<Y*, T*>, "Inconvertible types");
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    UniquePtr& operator=(const UniquePtr&) = delete;
+    UniquePtr& operator=(UniquePtr&& other) {
+        if (this != &other) {
+            Reset(other.Release());
+            GetDeleter() = std::move(other.GetDeleter());
+        }
+        return *this;
+    }
+    template <typename Y, typename E>
+    UniquePtr& operator=(UniquePtr<Y, E>&& other) {
+        static_assert(std::is_convertible_v<Y*, T*>, "Inconvertible types");
+        Reset(other.Release());
+        GetDeleter() = std::move(other.GetDeleter());
+        return *this;
+    }
+    UniquePtr& operator=(std::nullptr_t) {
+        Reset();
+        return *this;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~UniquePtr() {
+        Reset();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    T* Release() {
+        T* ptr = data_.GetFirst();
+        data_.GetFirst() = nullptr;
+        return ptr;
+    }
+    void Reset(T* ptr = nullptr) {
+        T* old = data_.GetFirst();
+        data_.GetFirst() = ptr;
+        if (old != nullptr) {
+            GetDeleter()(old);
+        }
+    }
+    void Swap(UniquePtr& other) {
+        std::swap(data_, other.data_);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    T* Get() const {
+        return data_.GetFirst();
+    }
+    D& GetDeleter() {
+        return data_.GetSecond();
+    }
+    const D& GetDeleter() const {
+        return data_.GetSecond();
+    }
+    explicit operator bool() const {
+        return Get() != nullptr;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Single-object version
+
+    std::add_lvalue_reference_t<T> operator*() const {
+        return *Get();
+    }
+    T* operator->() const {
+        return Get();
+    }
+
+private:
+    CompressedPair<T*, D> data_;
+};
+
+template <typename T, typename D, typename U, typename E>
+inline bool operator==(const UniquePtr<T, D>& left, const UniquePtr<U, E>& right) {
+    return left.Get() == right.Get();
+}
+
+template <typename T, typename... Args>
+UniquePtr<T> MakeUnique(Args&&... args) {
+    return UniquePtr<T>(new T(std::forward<Args>(args)...));
+}
+
+// Builds the object straight into a `SharedPtr` control block, so that a later promotion with
+// `SharedPtr(UniquePtr&&)` allocates nothing. Costs one word per pointer and the unused counters
+// while the object stays unique.
+template <typename T, typename... Args>
+UniquePtr<T, ShareableDelete<T>> MakeUniqueShareable(Args&&... args) {
+    static_assert(!std::is_convertible_v<T*, ControlBlockBase*>,
+                  "Objects with an embedded control block are always shareable: use MakeUnique");
+    auto* block = new ControlBlockWithObject<T>(std::forward<Args>(args)...);
+    return UniquePtr<T, ShareableDelete<T>>(block->ptr_, ShareableDelete<T>(block));
+}
@@ -2,6 +2,7 @@
 
 #include "sw_fwd.h"  // Forward declaration
 #include "shared.h"
+#include <functional>
 
 // https://en.cppreference.com/w/cpp/memory/weak_ptr
 template <typename T>
@@ -10,8 +11,13 @@ class WeakPtr {
     friend class WeakPtr;
     template <typename Y>
     friend class SharedPtr;
+    friend struct OwnerAccess;
+    template <typename Y>
+    friend class EnableSharedFromThis;
 
 public:
+    using element_type = std::remove_extent_t<T>;
+
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Constructors
 
@@ -57,7 +63,7 @@ public:
     // Demote `SharedPtr`
     // #2 from https://en.cppreference.com/w/cpp/memory/weak_ptr/weak_ptr
     WeakPtr(const SharedPtr<T>& other) {
-        cb_ = other.cb_;
+        cb_ = SharedPtr<T>::ShareBlock(other);
         ptr_ = other.ptr_;
         if (cb_ != nullptr) {
             cb_->weak_counter_++;
@@ -67,7 +73,7 @@ public:
     template <typename Y>
     WeakPtr(const SharedPtr<Y>& other) {
         static_assert(std::is_convertible_v<Y*, T*>, "Inconvertible types");
-        cb_ = other.cb_;
+        cb_ = SharedPtr<T>::ShareBlock(other);
         ptr_ = other.ptr_;
         if (cb_ != nullptr) {
             cb_->weak_counter_++;
@@ -133,7 +139,7 @@ public:
         if (cb_ != nullptr) {
             cb_->weak_counter_--;
             if (cb_->strong_counter_ == 0 && cb_->weak_counter_ == 0) {
-                delete cb_;
+                cb_->DeleteBlock();
             }
         }
         ptr_ = nullptr;
@@ -148,10 +154,10 @@ public:
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Observers
 
-    T& operator*() const {
+    element_type& operator*() const {
         return *ptr_;
     }
-    T* operator->() const {
+    element_type* operator->() const {
         return ptr_;
     }
 
@@ -171,7 +177,18 @@ public:
         return SharedPtr<T>(*this);
     }
 
+    // Ordering by control block instead of by stored pointer: aliased pointers sharing an owner
+    // are equivalent, and so are a `SharedPtr` and the `WeakPtr`s observing it.
+    template <typename Y>
+    bool OwnerBefore(const SharedPtr<Y>& other) const {
+        return std::less<const void*>{}(cb_, other.Owner());
+    }
+    template <typename Y>
+    bool OwnerBefore(const WeakPtr<Y>& other) const {
+        return std::less<const void*>{}(cb_, other.cb_);
+    }
+
 private:
-    T* ptr_;
+    element_type* ptr_;
     ControlBlockBase* cb_;
 };